@@ -0,0 +1,51 @@
+import sys
+import time
+import numpy as np
+from videoio import VideoReader
+
+# File reading through stdio vs a memory mapping, for sequential reading and seek-heavy access:
+# seek-then-read of single frames (hinted random, the hint isn't reset by the reads), and get_frames.
+# Run on a cold page cache (e.g. after `echo 3 > /proc/sys/vm/drop_caches`) to see the effect of madvise.
+
+vpath = sys.argv[1]
+n_seeks = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+
+
+def sequential(io_mode):
+    reader = VideoReader(vpath, io_mode=io_mode)
+    n, got = 0, True
+    ts = time.time()
+    while got:
+        got, _ = reader.read()
+        n += int(got)
+    te = time.time()
+    reader.release()
+    return n / (te - ts)
+
+
+def seek_then_read(io_mode, indices):
+    reader = VideoReader(vpath, io_mode=io_mode, index=True)
+    ts = time.time()
+    for i in indices:
+        reader.seek_frame(int(i))
+        reader.read()
+    te = time.time()
+    reader.release()
+    return len(indices) / (te - ts)
+
+
+def get_frames(io_mode, indices):
+    reader = VideoReader(vpath, io_mode=io_mode, index=True)
+    ts = time.time()
+    reader.get_frames(indices)
+    te = time.time()
+    reader.release()
+    return len(indices) / (te - ts)
+
+
+n_frames = VideoReader(vpath, index=True).frame_count
+indices = np.random.randint(n_frames, size=(n_seeks,))
+for io_mode in ("stdio", "mmap"):
+    print("{:5s}: sequential {:.1f} fps, seek-then-read {:.1f} frames/s, get_frames {:.1f} frames/s".format(
+        io_mode, sequential(io_mode), seek_then_read(io_mode, indices), get_frames(io_mode, indices)
+    ))
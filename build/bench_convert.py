@@ -0,0 +1,32 @@
+import sys
+import time
+from videoio import VideoReader
+
+# Pixel format conversion in horizontal slices with several threads.
+# Only unscaled conversion is sliced, the images are kept in the video size here.
+# Decoding is the same for all runs, so the difference comes from the conversion.
+
+vpath = sys.argv[1]
+max_frames = int(sys.argv[2]) if len(sys.argv) > 2 else 300
+
+
+def run(n_threads):
+    reader = VideoReader(vpath)
+    reader.convert_threads = n_threads
+    n = 0
+    ts = time.time()
+    while n < max_frames:
+        got, _ = reader.read()
+        if not got:
+            break
+        n += 1
+    te = time.time()
+    reader.release()
+    return n / (te - ts)
+
+
+base = run(1)
+print("1 threads: {:.1f} fps".format(base))
+for n_threads in (2, 4, 8):
+    fps = run(n_threads)
+    print("{} threads: {:.1f} fps, x{:.2f}".format(n_threads, fps, fps / base))
@@ -0,0 +1,30 @@
+import sys
+import time
+import numpy as np
+from videoio import VideoReader
+
+# Random access of K frames: seek_frame + read loop vs get_frames.
+
+vpath = sys.argv[1]
+k = int(sys.argv[2]) if len(sys.argv) > 2 else 64
+
+reader = VideoReader(vpath, index=True)
+indices = np.random.randint(reader.frame_count, size=(k,))
+
+ts = time.time()
+frames = []
+for i in indices:
+    reader.seek_frame(int(i))
+    got, im = reader.read()
+    assert got
+    frames.append(im)
+naive = np.stack(frames)
+te = time.time()
+print("seek loop:  {} frames, {:.2f} ms".format(k, (te - ts) * 1000))
+
+ts = time.time()
+got, batch = reader.get_frames(indices)
+te = time.time()
+assert got
+print("get_frames: {} frames, {:.2f} ms".format(k, (te - ts) * 1000))
+print("max diff:", np.abs(naive.astype(np.int32) - batch.astype(np.int32)).max())
@@ -0,0 +1,34 @@
+import os
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+import numpy as np
+from videoio import VideoReader
+
+# Many readers of one file for parallel random access: a stdio file each vs one shared descriptor read by pread.
+
+vpath = sys.argv[1]
+n_readers = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+n_frames_per_reader = 32
+
+n_frames = VideoReader(vpath, index=True).frame_count
+indices = [np.sort(np.random.randint(n_frames, size=(n_frames_per_reader,))) for _ in range(n_readers)]
+
+
+def run(io_mode):
+    readers = [VideoReader(vpath, io_mode=io_mode, index=True) for _ in range(n_readers)]
+    n_fds = len(os.listdir("/proc/self/fd")) if os.path.exists("/proc/self/fd") else -1
+    ts = time.time()
+    with ThreadPoolExecutor(n_readers) as pool:
+        batches = list(pool.map(lambda ri: ri[0].get_frames(ri[1]), zip(readers, indices)))
+    te = time.time()
+    for reader in readers:
+        reader.release()
+    return batches, n_readers * n_frames_per_reader / (te - ts), n_fds
+
+
+ref, fps, fds = run("stdio")
+print("stdio: {:.1f} frames/s, {} fds open".format(fps, fds))
+got, fps, fds = run("pread")
+print("pread: {:.1f} frames/s, {} fds open".format(fps, fds))
+assert all(np.array_equal(a, b) for a, b in zip(ref, got))
@@ -0,0 +1,31 @@
+import sys
+import time
+from videoio import VideoReader
+
+# Sequential decoding with stdio vs read-ahead windows, with the time the demuxer stalled on reading.
+# Meant for files on network filesystems (NFS / FUSE), where each read may block for milliseconds.
+
+vpath = sys.argv[1]
+WINDOWS = [8 << 20, 32 << 20, 64 << 20]
+
+
+def sequential(io_mode, readahead=0):
+    reader = VideoReader(vpath, io_mode=io_mode, readahead=readahead)
+    n, got = 0, True
+    ts = time.time()
+    while got:
+        got, _ = reader.read()
+        n += int(got)
+    te = time.time()
+    stats = reader.io_stats
+    reader.release()
+    return n / (te - ts), stats
+
+
+fps, _ = sequential("stdio")
+print("stdio          : {:.1f} fps".format(fps))
+for window in WINDOWS:
+    fps, stats = sequential("readahead", window)
+    print("readahead {:3d}MB: {:.1f} fps, read {:.1f} MB, stalled {:.1f} ms".format(
+        window >> 20, fps, stats["bytes_read"] / (1 << 20), stats["stall_ms"]
+    ))
@@ -0,0 +1,32 @@
+import sys
+import time
+from videoio import VideoReader
+
+# Sampling at a low fps: reading all frames and dropping in python vs sample_fps of reader.
+
+vpath = sys.argv[1]
+sample_fps = float(sys.argv[2]) if len(sys.argv) > 2 else 2.0
+
+reader = VideoReader(vpath)
+step = max(int(round(reader.fps / sample_fps)), 1)
+
+ts = time.time()
+n, i, got = 0, 0, True
+while got:
+    got, _ = reader.read()
+    if got and i % step == 0:
+        n += 1
+    i += 1
+te = time.time()
+naive = te - ts
+print("read all:   {} frames in {:.2f}s".format(n, naive))
+
+reader = VideoReader(vpath)
+reader.sample_fps = sample_fps
+ts = time.time()
+n, got = 0, True
+while got:
+    got, _ = reader.read()
+    n += int(got)
+te = time.time()
+print("sample_fps: {} frames in {:.2f}s, x{:.1f}".format(n, te - ts, naive / (te - ts)))
@@ -0,0 +1,51 @@
+import os
+import sys
+import time
+import tempfile
+import numpy as np
+from videoio import VideoReader
+from videoio.bind.videoio import VideoWriter as CPP_VideoWriter
+
+# Seek latency on several GOP structures: all-intra, short GOP and long GOP.
+# Random seeks, and short forward hops where decoding forward should win.
+
+n_frames = int(sys.argv[1]) if len(sys.argv) > 1 else 600
+n_seeks = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+size = (640, 360)
+
+
+def make_video(path, g):
+    writer = CPP_VideoWriter()
+    assert writer.open(path, size, 30.0, g=g)
+    for i in range(n_frames):
+        im = np.zeros((size[1], size[0], 3), np.uint8)
+        im[..., 0] = i % 256
+        im[:, (i * 4) % size[0]] = 255
+        writer.write(im)
+    writer.release()
+
+
+def bench(path, indices, index):
+    reader = VideoReader(path, index=index)
+    ts = time.time()
+    for i in indices:
+        assert reader.seek_frame(int(i))
+        got, _ = reader.read()
+        assert got
+    te = time.time()
+    reader.release()
+    return (te - ts) * 1000 / len(indices)
+
+
+rng = np.random.default_rng(0)
+random_indices = rng.integers(n_frames, size=(n_seeks,))
+hop_indices = np.cumsum(rng.integers(1, 30, size=(n_seeks,))) % n_frames
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    for g in (1, 12, 250):
+        path = os.path.join(tmpdir, "g{}.mp4".format(g))
+        make_video(path, g)
+        for index in (False, True):
+            print("g={:<4d} index={:<5}  random: {:7.2f} ms/seek,  hops: {:7.2f} ms/seek".format(
+                g, str(index), bench(path, random_indices, index), bench(path, hop_indices, index)
+            ))
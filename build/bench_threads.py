@@ -0,0 +1,30 @@
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+from videoio import VideoReader
+
+# Decoding throughput of several readers in threads of one process.
+# Decoding releases the GIL, so it should scale with the number of threads.
+
+vpath = sys.argv[1]
+max_frames = int(sys.argv[2]) if len(sys.argv) > 2 else 300
+
+
+def decode(_):
+    reader = VideoReader(vpath)
+    n = 0
+    while n < max_frames:
+        got, _ = reader.read()
+        if not got:
+            break
+        n += 1
+    reader.release()
+    return n
+
+
+for n_threads in (1, 2, 4, 8):
+    with ThreadPoolExecutor(max_workers=n_threads) as pool:
+        ts = time.time()
+        n_frames = sum(pool.map(decode, range(n_threads)))
+        te = time.time()
+    print("{} threads: {} frames, {:.1f} fps".format(n_threads, n_frames, n_frames / (te - ts)))
@@ -0,0 +1,41 @@
+import sys
+import time
+from videoio import VideoReader, LOWRES_AUTO
+
+# Thumbnails of key frames: decoding every frame (the old way, non-key ones are dropped in python),
+# against keyframes_only (and lowres, for codecs supporting it).
+
+vpath = sys.argv[1]
+size = (160, 90)
+
+
+def run_full():
+    reader = VideoReader(vpath, image_size=size)
+    n, got = 0, True
+    ts = time.time()
+    while got:
+        got, _ = reader.read()
+        n += int(got)
+    te = time.time()
+    reader.release()
+    return n, te - ts
+
+
+def run_keyframes(lowres):
+    reader = VideoReader(vpath, image_size=size, keyframes_only=True, lowres=lowres)
+    n, got = 0, True
+    ts = time.time()
+    while got:
+        got, _ = reader.read()
+        n += int(got)
+    te = time.time()
+    reader.release()
+    return n, te - ts
+
+
+n, sec = run_full()
+print("all frames:            {} frames in {:.2f}s".format(n, sec))
+n, sec_key = run_keyframes(0)
+print("keyframes_only:        {} thumbnails in {:.2f}s, x{:.1f}".format(n, sec_key, sec / sec_key))
+n, sec_low = run_keyframes(LOWRES_AUTO)
+print("keyframes_only+lowres: {} thumbnails in {:.2f}s, x{:.1f}".format(n, sec_low, sec / sec_low))
@@ -0,0 +1,20 @@
+import gc
+import sys
+import numpy as np
+from videoio import VideoReader, BytesVideoReader
+
+# In-memory input: bytes, bytearray and numpy buffers, dropped by the caller right after opening.
+
+vpath = sys.argv[1]
+N_FRAMES = 30
+
+ref = VideoReader(vpath).read_batch(N_FRAMES)
+
+with open(vpath, "rb") as fp:
+    data = fp.read()
+for make in (bytes, bytearray, lambda x: np.frombuffer(x, np.uint8).copy()):
+    reader = BytesVideoReader(make(data))
+    gc.collect()  # the buffer is only referenced by the reader now
+    batch = reader.read_batch(N_FRAMES)
+    assert np.array_equal(batch, ref), type(make(b""))
+print("ok")
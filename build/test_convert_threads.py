@@ -0,0 +1,30 @@
+import os
+import subprocess
+import tempfile
+import numpy as np
+from videoio import VideoReader
+
+# Sliced conversion (convert_threads > 1) equals the single-threaded one, with and without a width change.
+# Scaled conversions aren't sliced: slice edges would show in the interpolated chroma.
+
+N_FRAMES = 10
+W, H = 640, 360
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    path = os.path.join(tmpdir, "src.mp4")
+    subprocess.run(
+        ["ffmpeg", "-y", "-loglevel", "error", "-f", "lavfi", "-i", "testsrc2=size={}x{}:rate=30".format(W, H),
+         "-frames:v", str(N_FRAMES), "-c:v", "libx264", "-pix_fmt", "yuv420p", path],
+        check=True,
+    )
+    for image_size in ((0, 0), (480, H), (W + 160, H)):
+        for fast_convert in (True, False):
+            batches = []
+            for threads in (1, 4):
+                reader = VideoReader()
+                reader.fast_convert = fast_convert
+                reader.convert_threads = threads
+                reader.open(path, image_size=image_size)
+                batches.append(reader.read_batch(N_FRAMES))
+            assert np.array_equal(batches[0], batches[1]), (image_size, fast_convert)
+        print(image_size, "ok")
@@ -0,0 +1,43 @@
+import os
+import subprocess
+import tempfile
+import numpy as np
+from videoio import VideoReader
+
+# Gray output is the luma plane of decoded frames: compare with the Y plane dumped by ffmpeg.
+# The zero-copy image must be the decoded plane itself (same row stride as the Y plane of "yuv" output),
+# not a converted copy. The width isn't a multiple of 32, so decoded and converted rows differ in stride.
+
+N_FRAMES = 10
+W, H = 600, 360
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    path = os.path.join(tmpdir, "src.mp4")
+    subprocess.run(
+        ["ffmpeg", "-y", "-loglevel", "error", "-f", "lavfi", "-i", "testsrc2=size={}x{}:rate=30".format(W, H),
+         "-frames:v", str(N_FRAMES), "-c:v", "libx264", "-pix_fmt", "yuv420p", path],
+        check=True,
+    )
+    raw = subprocess.run(
+        ["ffmpeg", "-loglevel", "error", "-i", path, "-f", "rawvideo", "-pix_fmt", "yuv420p", "-"],
+        check=True, stdout=subprocess.PIPE,
+    ).stdout
+    yuv = np.frombuffer(raw, np.uint8).reshape(N_FRAMES, H * W * 3 // 2)
+    ref = yuv[:, :H * W].reshape(N_FRAMES, H, W, 1)
+
+    for zero_copy in (False, True):
+        reader = VideoReader(path, pix_fmt="gray")
+        for i in range(N_FRAMES):
+            got, im = reader.read(zero_copy=zero_copy)
+            assert got and im.shape == (H, W, 1), im.shape
+            assert np.array_equal(im, ref[i]), "frame {} differs (zero_copy={})".format(i, zero_copy)
+
+    gray = VideoReader(path, pix_fmt="gray")
+    yuv = VideoReader(path, pix_fmt="yuv")
+    for i in range(N_FRAMES):
+        _, im = gray.read(zero_copy=True)
+        _, planes = yuv.read_planes(zero_copy=True)
+        assert im.strides[0] == planes[0].strides[0], "frame {} is converted: stride {} != linesize {}".format(
+            i, im.strides[0], planes[0].strides[0]
+        )
+    print("ok")
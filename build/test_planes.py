@@ -0,0 +1,40 @@
+import os
+import subprocess
+import tempfile
+import numpy as np
+from videoio import VideoReader
+
+# Planar yuv output equals the frames dumped by ffmpeg, as planes and as packed bytes.
+
+N_FRAMES = 10
+W, H = 640, 360
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    path = os.path.join(tmpdir, "src.mp4")
+    subprocess.run(
+        ["ffmpeg", "-y", "-loglevel", "error", "-f", "lavfi", "-i", "testsrc2=size={}x{}:rate=30".format(W, H),
+         "-frames:v", str(N_FRAMES), "-c:v", "libx264", "-pix_fmt", "yuv420p", path],
+        check=True,
+    )
+    for pix_fmt in ("yuv", "yuv420p", "nv12"):
+        raw = subprocess.run(
+            ["ffmpeg", "-loglevel", "error", "-i", path, "-f", "rawvideo",
+             "-pix_fmt", "yuv420p" if pix_fmt == "yuv" else pix_fmt, "-"],
+            check=True, stdout=subprocess.PIPE,
+        ).stdout
+        ref = np.frombuffer(raw, np.uint8).reshape(N_FRAMES, -1)
+
+        for zero_copy in (False, True):
+            reader = VideoReader(path, pix_fmt=pix_fmt)
+            for i in range(N_FRAMES):
+                got, planes = reader.read_planes(zero_copy=zero_copy)
+                assert got
+                for (off, shape), plane in zip(reader.planes, planes):
+                    assert plane.shape == shape, (plane.shape, shape)
+                    size = int(np.prod(shape))
+                    assert np.array_equal(plane.reshape(-1), ref[i, off:off + size]), (pix_fmt, i, off)
+
+        reader = VideoReader(path, pix_fmt=pix_fmt)
+        batch = reader.read_batch(N_FRAMES)
+        assert np.array_equal(batch, ref), pix_fmt
+        print(pix_fmt, "ok")
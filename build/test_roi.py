@@ -0,0 +1,33 @@
+import os
+import subprocess
+import tempfile
+import numpy as np
+from videoio import VideoReader
+
+# Frames read with roi should equal the same region of whole frames (unscaled, even top-left).
+
+N_FRAMES = 10
+ROIS = [(0, 0, 64, 64), (100, 50, 320, 180), (638, 358, 2, 2), (200, 120, 101, 77)]
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    path = os.path.join(tmpdir, "src.mp4")
+    subprocess.run(
+        ["ffmpeg", "-y", "-loglevel", "error", "-f", "lavfi", "-i", "testsrc2=size=640x360:rate=30",
+         "-frames:v", str(N_FRAMES), "-c:v", "libx264", "-pix_fmt", "yuv420p", path],
+        check=True,
+    )
+
+    whole = VideoReader(path)
+    cropped = VideoReader(path)
+    for i in range(N_FRAMES):
+        x, y, w, h = ROIS[i % len(ROIS)]
+        # Changed per frame.
+        cropped.set_roi((x, y, w, h))
+        got0, im = whole.read()
+        got1, roi = cropped.read()
+        assert got0 and got1
+        assert roi.shape == (h, w, 3), roi.shape
+        diff = np.abs(im[y:y + h, x:x + w].astype(np.int32) - roi.astype(np.int32)).max()
+        print("frame {} roi {}: max diff {}".format(i, (x, y, w, h), diff))
+        assert diff == 0
+    print("ok")
@@ -0,0 +1,88 @@
+import io
+import sys
+import numpy as np
+from videoio import VideoReader, StreamVideoReader
+
+# Stream input: seekable and non-seekable file-like objects, and chunk iterators, equal to reading the file.
+# Mp4 files with the moov atom at the end need seeking, use a fragmented or faststart file for the sequential cases.
+
+vpath = sys.argv[1]
+N_FRAMES = 30
+
+ref = VideoReader(vpath).read_batch(N_FRAMES)
+with open(vpath, "rb") as fp:
+    data = fp.read()
+
+
+class Pipe(io.RawIOBase):
+    """Non-seekable, short reads like a socket."""
+
+    def __init__(self, data):
+        self._data, self._pos = data, 0
+
+    def readable(self):
+        return True
+
+    def read(self, n=-1):
+        n = min(n, 65536)
+        ret = self._data[self._pos:self._pos + n]
+        self._pos += len(ret)
+        return ret
+
+
+def chunks(data, size=100000):
+    for i in range(0, len(data), size):
+        yield data[i:i + size]
+
+
+sources = {
+    "file": lambda: open(vpath, "rb"),
+    "bytesio": lambda: io.BytesIO(data),
+    "pipe": lambda: Pipe(data),
+    "chunks": lambda: chunks(data),
+}
+for name, make in sources.items():
+    for readahead in (0, 1 << 20, 16 << 20):
+        reader = StreamVideoReader(make(), readahead=readahead)
+        batch = reader.read_batch(N_FRAMES)
+        assert np.array_equal(batch, ref), (name, readahead)
+        reader.release()
+    print(name, "ok")
+
+
+# A source failing partway (e.g. a dropped download): reading fails, the process keeps running.
+class Dropped(Exception):
+    pass
+
+
+def dropped_chunks(data, n_bytes, size=100000):
+    for chunk in chunks(data[:n_bytes], size):
+        yield chunk
+    raise Dropped("connection lost")
+
+
+class DroppedPipe(Pipe):
+    def __init__(self, data, n_bytes):
+        super().__init__(data)
+        self._n_bytes = n_bytes
+
+    def read(self, n=-1):
+        if self._pos >= self._n_bytes:
+            raise Dropped("connection lost")
+        return super().read(min(n, self._n_bytes - self._pos))
+
+
+n_total = VideoReader(vpath).frame_count
+for name, make in {
+    "dropped chunks": lambda: dropped_chunks(data, len(data) // 2),
+    "dropped pipe": lambda: DroppedPipe(data, len(data) // 2),
+}.items():
+    for readahead in (0, 1 << 20):
+        reader = StreamVideoReader(make(), readahead=readahead)
+        n, got = 0, True
+        while got:
+            got, _ = reader.read()
+            n += int(got)
+        assert not got and 0 < n < n_total, (name, readahead, n, n_total)
+        reader.release()
+    print(name, "ok")
@@ -0,0 +1,56 @@
+import os
+import subprocess
+import tempfile
+import numpy as np
+from videoio import VideoReader
+
+# Compare the simd yuv -> rgb kernels (fast_convert) with swscale, on several matrices, ranges and formats.
+# Both honour the colour matrix and range of the video, results should differ by rounding only.
+
+TOLERANCE = 3
+N_FRAMES = 10
+
+# (name, ffmpeg output arguments)
+VARIANTS = [
+    ("bt601_tv.mp4",  ["-c:v", "libx264", "-pix_fmt", "yuv420p",  "-colorspace", "smpte170m", "-color_range", "tv"]),
+    ("bt709_tv.mp4",  ["-c:v", "libx264", "-pix_fmt", "yuv420p",  "-colorspace", "bt709",     "-color_range", "tv"]),
+    ("bt709_pc.mp4",  ["-c:v", "libx264", "-pix_fmt", "yuvj420p", "-colorspace", "bt709",     "-color_range", "pc"]),
+    ("nv12_709.nut",  ["-c:v", "rawvideo", "-pix_fmt", "nv12",    "-colorspace", "bt709",     "-color_range", "tv"]),
+    ("odd_size.mp4",  ["-c:v", "libx264", "-pix_fmt", "yuv420p",  "-vf", "crop=637:359:0:0"]),
+]
+
+
+def read_frames(path, pix_fmt, fast):
+    reader = VideoReader()
+    reader.fast_convert = fast
+    reader.open(path, pix_fmt=pix_fmt)
+    frames = []
+    for _ in range(N_FRAMES):
+        got, im = reader.read()
+        if not got:
+            break
+        frames.append(im)
+    reader.release()
+    return np.stack(frames)
+
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    failed = False
+    for name, args in VARIANTS:
+        path = os.path.join(tmpdir, name)
+        subprocess.run(
+            ["ffmpeg", "-y", "-loglevel", "error", "-f", "lavfi", "-i", "testsrc2=size=640x360:rate=30",
+             "-frames:v", str(N_FRAMES)] + args + [path],
+            check=True,
+        )
+        for pix_fmt in ("bgr", "rgb", "rgba"):
+            fast = read_frames(path, pix_fmt, True).astype(np.int32)
+            ref = read_frames(path, pix_fmt, False).astype(np.int32)
+            assert fast.shape == ref.shape, (fast.shape, ref.shape)
+            diff = np.abs(fast - ref)
+            ok = diff.max() <= TOLERANCE
+            failed = failed or not ok
+            print("{:<14s} {:<5s} max diff {:3d}, mean {:.3f}  {}".format(
+                name, pix_fmt, diff.max(), diff.mean(), "ok" if ok else "FAILED"
+            ))
+    assert not failed
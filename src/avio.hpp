@@ -1,4 +1,10 @@
 #pragma once
+#include <cerrno>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
 #include "log.hpp"
 
 extern "C" {
@@ -7,10 +13,34 @@ extern "C" {
 }
 #include "common.hpp"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define DEFAULT_AVIO_BUFFER_SZ 32768
 
 namespace vio {
 
+// How local files are read.
+enum class IOMode {
+    Stdio,      // fread
+    Mmap,       // served from a memory mapping, falls back to stdio if the file can't be mapped
+    ReadAhead,  // fread by a worker, a window ahead of the demuxer (e.g. for network filesystems)
+    Pread,      // pread at the reader's own offset, readers of a file share one descriptor (stdio on windows)
+};
+
+// Access pattern of reading, hinted to the IO context.
+enum class IOAccess { Normal, Sequential, Random };
+
+// Counters of an IO context, zeros if it doesn't count.
+struct IOStats {
+    uint64_t bytes_read = 0;  // from the source, including read-ahead bytes dropped by seeking
+    double   stall_ms   = 0;  // time the demuxer waited for bytes
+};
+
 class AVIOBase{
 public:
     AVIOBase(size_t buffer_size)
@@ -25,12 +55,20 @@ public:
 
     virtual int read(unsigned char* buf, int buf_size) = 0;
     virtual int64_t seek(int64_t offset, int whence) = 0;
+    // Hint of the access pattern, for contexts that can use it.
+    virtual void advise(IOAccess) {}
+    // False for streams that can only be read forward.
+    virtual bool seekable() const { return true; }
+    virtual auto stats() const -> IOStats { return {}; }
 
     void associateFormatContext(AVFormatContext * fmt_ctx) {
         if (fmt_ctx && ctx_) {
             fmt_ctx->pb = ctx_;
             fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
-            fmt_ctx->iformat = this->probeInputFormat();
+            // Probing seeks back, streams are probed by the demuxer from its buffer instead.
+            if (this->seekable()) {
+                fmt_ctx->iformat = this->probeInputFormat();
+            }
             if (fmt_ctx->iformat) {
                 // spdlog::info(
                 //     "AVInputFormat: {} ({}), SEEK_TO_TS {}"
@@ -139,12 +177,18 @@ private:
     FILE * input_file_;
 };
 
+
+/**
+ * Reads from memory in place, 64-bit sizes.
+ * Reads larger than the AVIO buffer (e.g. packets) are copied by avio from the memory into their destination,
+ * small ones and short forward seeks (e.g. skipping atoms) are served from the buffer.
+ * */
 class AVMemoryIOContext : public AVIOBase {
 public:
     AVMemoryIOContext(const uint8_t * data, size_t size, size_t buffer_size = DEFAULT_AVIO_BUFFER_SZ)
         : AVIOBase(buffer_size)
         , memory_(data)
-        , memory_size_(size)
+        , memory_size_((int64_t)size)
         , offset_(0)
     {
         ctx_ = avio_alloc_context(
@@ -173,12 +217,10 @@ public:
         }
 
         auto * h = static_cast<AVMemoryIOContext *>(opaque);
-        int reminder = h->memory_size_ - h->offset_;
-        int r = (buf_size < reminder) ? buf_size : reminder;
-        if (r < 0) {
+        if (h->offset_ >= h->memory_size_) {
             return AVERROR_EOF;
         }
-    
+        int r = (int)std::min((int64_t)buf_size, h->memory_size_ - h->offset_);
         memcpy(buf, h->memory_ + h->offset_, r);
         h->offset_ += r;
         return r;
@@ -186,27 +228,215 @@ public:
 
     static int64_t SeekMemory(void* opaque, int64_t offset, int whence) {
         auto * h = static_cast<AVMemoryIOContext *>(opaque);
+        int64_t pos = 0;
         switch (whence) {
         case SEEK_CUR: // from current position
-            h->offset_ += offset;
+            pos = h->offset_ + offset;
             break;
         case SEEK_END: // from eof
-            h->offset_ = h->memory_size_ + offset;
+            pos = h->memory_size_ + offset;
             break;
         case SEEK_SET: // from beginning of file
-            h->offset_ = offset;
+            pos = offset;
             break;
         case AVSEEK_SIZE:
             return h->memory_size_;
+        default:
+            return -1;
+        }
+        if (pos < 0) {
+            return -1;
         }
+        h->offset_ = pos;
         return h->offset_;
     }
 
-private:
+protected:
     // for memory mode
     const uint8_t * memory_;
-    int memory_size_;
-    int offset_;
+    int64_t memory_size_;
+    int64_t offset_;
+};
+
+#ifndef _WIN32
+/**
+ * Reads a local file from a read-only memory mapping, without a syscall per read.
+ * The access pattern is hinted to the kernel with madvise (readahead for sequential reading, none for random).
+ * */
+class AVMmapIOContext : public AVMemoryIOContext {
+public:
+    // nullptr if the file can't be mapped (e.g. empty, or not a regular file).
+    static auto Open(const std::string & filename, size_t buffer_size = DEFAULT_AVIO_BUFFER_SZ) -> std::unique_ptr<AVIOBase> {
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        void * data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);  // the mapping keeps the file
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        return std::unique_ptr<AVIOBase>(new AVMmapIOContext(static_cast<uint8_t const *>(data), (size_t)st.st_size, buffer_size));
+    }
+    ~AVMmapIOContext() {
+        munmap(const_cast<uint8_t *>(memory_), (size_t)memory_size_);
+    }
+
+    void advise(IOAccess access) override {
+        if (access == access_) {
+            return;
+        }
+        int advice = (access == IOAccess::Sequential) ? MADV_SEQUENTIAL
+                   : (access == IOAccess::Random)     ? MADV_RANDOM
+                   : MADV_NORMAL;
+        madvise(const_cast<uint8_t *>(memory_), (size_t)memory_size_, advice);
+        access_ = access;
+    }
+
+private:
+    AVMmapIOContext(uint8_t const * data, size_t size, size_t buffer_size)
+        : AVMemoryIOContext(data, size, buffer_size)
+        , access_(IOAccess::Normal)
+    {}
+
+    IOAccess access_;
+};
+
+/**
+ * Reads a local file by pread at its own offset, 64-bit and without a stdio buffer.
+ * Contexts of the same file share one descriptor and its size (read once), so many readers of a file
+ * (e.g. for parallel random access) neither race on a file position nor hold a descriptor each.
+ * */
+class AVPreadIOContext : public AVIOBase {
+public:
+    // nullptr if the file can't be opened (or is not a regular file).
+    static auto Open(const std::string & filename, size_t buffer_size = DEFAULT_AVIO_BUFFER_SZ) -> std::unique_ptr<AVIOBase> {
+        auto file = SharedFile::Open(filename);
+        if (!file) {
+            return nullptr;
+        }
+        return std::unique_ptr<AVIOBase>(new AVPreadIOContext(std::move(file), buffer_size));
+    }
+
+    int read(unsigned char* buf, int buf_size) {
+        return ReadFile(this, buf, buf_size);
+    }
+
+    int64_t seek(int64_t offset, int whence) {
+        return SeekFile(this, offset, whence);
+    }
+
+    static int ReadFile(void* opaque, uint8_t * buf, int buf_size) {
+        if (buf_size < 0) {
+            return -1;
+        }
+        auto * h = static_cast<AVPreadIOContext *>(opaque);
+        ssize_t ret;
+        do {
+            ret = pread(h->file_->fd, buf, (size_t)buf_size, (off_t)h->offset_);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            return AVERROR(errno);
+        }
+        if (ret == 0) {
+            return AVERROR_EOF;
+        }
+        h->offset_ += ret;
+        return (int)ret;
+    }
+
+    static int64_t SeekFile(void* opaque, int64_t offset, int whence) {
+        auto * h = static_cast<AVPreadIOContext *>(opaque);
+        int64_t pos = 0;
+        switch (whence) {
+        case SEEK_CUR: // from current position
+            pos = h->offset_ + offset;
+            break;
+        case SEEK_END: // from eof
+            pos = h->file_->size + offset;
+            break;
+        case SEEK_SET: // from beginning of file
+            pos = offset;
+            break;
+        case AVSEEK_SIZE:
+            return h->file_->size;
+        default:
+            return -1;
+        }
+        if (pos < 0) {
+            return -1;
+        }
+        h->offset_ = pos;
+        return h->offset_;
+    }
+
+private:
+    // A descriptor shared by the contexts of a file, closed with the last one.
+    struct SharedFile {
+        int     fd;
+        int64_t size;
+
+        ~SharedFile() { ::close(fd); }
+
+        static auto Open(const std::string & filename) -> std::shared_ptr<SharedFile> {
+            // Never destroyed, files may be closed during exiting.
+            static auto * mutex = new std::mutex();
+            static auto * files = new std::map<std::pair<dev_t, ino_t>, std::weak_ptr<SharedFile>>();
+
+            struct stat st;
+            if (::stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                spdlog::error("Error opening video file: {}", filename);
+                return nullptr;
+            }
+            std::lock_guard<std::mutex> lock(*mutex);
+            auto it = files->find({st.st_dev, st.st_ino});
+            if (it != files->end()) {
+                if (auto file = it->second.lock()) {
+                    return file;
+                }
+            }
+
+            int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                spdlog::error("Error opening video file: {}", filename);
+                if (fd >= 0) ::close(fd);
+                return nullptr;
+            }
+            auto file = std::make_shared<SharedFile>();
+            file->fd = fd;
+            file->size = (int64_t)st.st_size;
+            (*files)[{st.st_dev, st.st_ino}] = file;
+            // Forget closed files.
+            for (it = files->begin(); it != files->end();) {
+                it = (it->second.expired()) ? files->erase(it) : std::next(it);
+            }
+            return file;
+        }
+    };
+
+    AVPreadIOContext(std::shared_ptr<SharedFile> file, size_t buffer_size)
+        : AVIOBase(buffer_size)
+        , file_(std::move(file))
+        , offset_(0)
+    {
+        ctx_ = avio_alloc_context(
+            AVIOBase::buffer_,
+            AVIOBase::buffer_size_,
+            0,
+            this,
+            &AVPreadIOContext::ReadFile,
+            nullptr, // no write function
+            &AVPreadIOContext::SeekFile
+        );
+    }
+
+    std::shared_ptr<SharedFile> file_;
+    int64_t offset_;
 };
+#endif
 
 }
@@ -0,0 +1,297 @@
+#include <cstdio>
+
+#include "log.hpp"
+#include "avio_stream.hpp"
+
+namespace vio {
+
+AVStreamIOContext::AVStreamIOContext(
+    ReadFn read_fn,
+    SeekFn seek_fn,
+    size_t readahead,
+    WaitFn wait_fn,
+    size_t buffer_size
+)
+    : AVIOBase(buffer_size)
+    , read_fn_(std::move(read_fn))
+    , seek_fn_(std::move(seek_fn))
+    , wait_fn_(std::move(wait_fn))
+    , readahead_(readahead)
+    , chunk_size_(std::max(buffer_size, std::min(readahead / 4, (size_t)1 << 20)))
+    , pos_(0)
+    , size_(-1)
+    , head_(0)
+    , buffered_(0)
+    , source_pos_(0)
+    , eof_(false)
+    , error_(false)
+    , stop_(false)
+    , bytes_read_(0)
+    , stall_(0)
+{
+    ctx_ = avio_alloc_context(
+        AVIOBase::buffer_,
+        AVIOBase::buffer_size_,
+        0,
+        this,
+        &AVStreamIOContext::ReadStream,
+        nullptr, // no write function
+        &AVStreamIOContext::SeekStream  // forward skipping for sequential streams too
+    );
+    if (ctx_ && !seek_fn_) {
+        ctx_->seekable = 0;
+    }
+    if (readahead_ > 0) {
+        worker_ = std::thread(&AVStreamIOContext::_readAhead, this);
+    }
+}
+
+AVStreamIOContext::~AVStreamIOContext() {
+    if (!worker_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    // The worker may be in the source, waiting for it to return.
+    if (wait_fn_) {
+        wait_fn_([this]() { worker_.join(); });
+    }
+    else {
+        worker_.join();
+    }
+}
+
+auto AVStreamIOContext::OpenFile(const std::string & filename, size_t readahead) -> std::unique_ptr<AVIOBase> {
+    std::shared_ptr<FILE> file(fopen(filename.c_str(), "rb"), [](FILE * fp) { if (fp) fclose(fp); });
+    if (!file) {
+        spdlog::error("Error opening video file: {}", filename);
+        return nullptr;
+    }
+    ReadFn read_file = [file](uint8_t * buf, int64_t size) -> int64_t {
+        size_t ret = fread(buf, 1, (size_t)size, file.get());
+        return (ret == 0 && ferror(file.get())) ? -1 : (int64_t)ret;
+    };
+    SeekFn seek_file = [file](int64_t offset, int whence) -> int64_t {
+#ifdef _WIN32
+        if (_fseeki64(file.get(), offset, whence) != 0) {
+            return -1;
+        }
+        return (int64_t)_ftelli64(file.get());
+#else
+        if (fseeko(file.get(), (off_t)offset, whence) != 0) {
+            return -1;
+        }
+        return (int64_t)ftello(file.get());
+#endif
+    };
+    return std::unique_ptr<AVIOBase>(new AVStreamIOContext(read_file, seek_file, readahead));
+}
+
+auto AVStreamIOContext::stats() const -> IOStats {
+    std::lock_guard<std::mutex> lock(mutex_);
+    IOStats ret;
+    ret.bytes_read = bytes_read_;
+    ret.stall_ms = std::chrono::duration<double, std::milli>(stall_).count();
+    return ret;
+}
+
+int AVStreamIOContext::read(unsigned char * buf, int buf_size) {
+    return ReadStream(this, buf, buf_size);
+}
+
+int64_t AVStreamIOContext::seek(int64_t offset, int whence) {
+    return SeekStream(this, offset, whence);
+}
+
+int AVStreamIOContext::ReadStream(void * opaque, uint8_t * buf, int buf_size) {
+    if (buf_size < 0) {
+        return -1;
+    }
+    auto * h = static_cast<AVStreamIOContext *>(opaque);
+    if (h->readahead_ > 0) {
+        return h->_readBuffered(buf, buf_size);
+    }
+
+    // Reading in the caller, it waits for all of the source.
+    std::lock_guard<std::mutex> source_lock(h->source_mutex_);
+    auto start = std::chrono::steady_clock::now();
+    int64_t r = h->read_fn_(buf, buf_size);
+    {
+        std::lock_guard<std::mutex> lock(h->mutex_);
+        h->stall_ += std::chrono::steady_clock::now() - start;
+        h->bytes_read_ += (uint64_t)std::max(r, (int64_t)0);
+    }
+    if (r < 0) {
+        return AVERROR(EIO);
+    }
+    if (r == 0) {
+        return AVERROR_EOF;
+    }
+    h->pos_ += r;
+    h->source_pos_ = h->pos_;
+    return (int)r;
+}
+
+int64_t AVStreamIOContext::SeekStream(void * opaque, int64_t offset, int whence) {
+    auto * h = static_cast<AVStreamIOContext *>(opaque);
+    int64_t target = 0;
+    switch (whence) {
+    case SEEK_CUR: // from current position
+        target = h->pos_ + offset;
+        break;
+    case SEEK_END: // from eof
+        target = h->_size();
+        if (target < 0) {
+            return -1;
+        }
+        target += offset;
+        break;
+    case SEEK_SET: // from beginning of file
+        target = offset;
+        break;
+    case AVSEEK_SIZE:
+        return h->_size();
+    default:
+        return -1;
+    }
+    if (target < 0) {
+        return -1;
+    }
+
+    // Forward in the buffer, or in a sequential stream.
+    bool forward = (target == h->pos_);
+    if (target > h->pos_) {
+        std::lock_guard<std::mutex> lock(h->mutex_);
+        forward = !h->seek_fn_ || target - h->pos_ <= (int64_t)h->buffered_;
+    }
+    if (forward) {
+        return h->_skip(target);
+    }
+    if (!h->seek_fn_) {
+        return -1;
+    }
+
+    // Drop the buffer and seek the source, the worker refills from there.
+    std::lock_guard<std::mutex> source_lock(h->source_mutex_);
+    if (h->seek_fn_(target, SEEK_SET) < 0) {
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(h->mutex_);
+        h->chunks_.clear();
+        h->head_ = 0;
+        h->buffered_ = 0;
+        h->eof_ = false;
+        h->error_ = false;
+        h->source_pos_ = target;
+        h->pos_ = target;
+    }
+    h->cond_.notify_all();
+    return target;
+}
+
+void AVStreamIOContext::_readAhead() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return stop_ || (!eof_ && !error_ && buffered_ < readahead_); });
+            if (stop_) {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> source_lock(source_mutex_);
+        {
+            // Seeking may have changed the state.
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_) {
+                break;
+            }
+            if (eof_ || error_ || buffered_ >= readahead_) {
+                continue;
+            }
+        }
+        std::vector<uint8_t> chunk(chunk_size_);
+        int64_t r = read_fn_(chunk.data(), (int64_t)chunk.size());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (r < 0) {
+                spdlog::error("[vio::AVStreamIOContext] Failed to read the stream at {}", source_pos_);
+                error_ = true;
+            }
+            else if (r == 0) {
+                eof_ = true;
+            }
+            else {
+                chunk.resize((size_t)r);
+                chunks_.push_back(std::move(chunk));
+                buffered_ += (size_t)r;
+                source_pos_ += r;
+                bytes_read_ += (uint64_t)r;
+            }
+        }
+        cond_.notify_all();
+    }
+}
+
+auto AVStreamIOContext::_readBuffered(uint8_t * buf, int buf_size) -> int {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (buffered_ == 0 && !eof_ && !error_) {
+        // The window is drained, the demuxer stalls.
+        auto start = std::chrono::steady_clock::now();
+        cond_.wait(lock, [this]() { return buffered_ > 0 || eof_ || error_; });
+        stall_ += std::chrono::steady_clock::now() - start;
+    }
+    if (buffered_ == 0) {
+        return error_ ? AVERROR(EIO) : AVERROR_EOF;
+    }
+
+    int n = 0;
+    while (n < buf_size && !chunks_.empty()) {
+        auto & chunk = chunks_.front();
+        size_t k = std::min((size_t)(buf_size - n), chunk.size() - head_);
+        memcpy(buf + n, chunk.data() + head_, k);
+        n += (int)k;
+        head_ += k;
+        buffered_ -= k;
+        if (head_ == chunk.size()) {
+            chunks_.pop_front();
+            head_ = 0;
+        }
+    }
+    pos_ += n;
+    lock.unlock();
+    cond_.notify_all();
+    return n;
+}
+
+auto AVStreamIOContext::_skip(int64_t target) -> int64_t {
+    uint8_t scratch[4096];
+    while (pos_ < target) {
+        int r = this->read(scratch, (int)std::min((int64_t)sizeof(scratch), target - pos_));
+        if (r <= 0) {
+            return -1;
+        }
+    }
+    return pos_;
+}
+
+auto AVStreamIOContext::_size() -> int64_t {
+    if (size_ == -1) {
+        size_ = -2;
+        if (seek_fn_) {
+            // Seek the source back to where the worker is.
+            std::lock_guard<std::mutex> source_lock(source_mutex_);
+            int64_t size = seek_fn_(0, SEEK_END);
+            if (size >= 0 && seek_fn_(source_pos_, SEEK_SET) >= 0) {
+                size_ = size;
+            }
+        }
+    }
+    return (size_ >= 0) ? size_ : -1;
+}
+
+}
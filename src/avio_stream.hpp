@@ -0,0 +1,85 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "avio.hpp"
+
+namespace vio {
+
+// Default bytes read ahead of the demuxer.
+constexpr size_t kDefaultReadAhead = (size_t)8 << 20;
+
+// Runs a blocking wait for a worker, e.g. releasing a lock the worker needs (like the python gil).
+using WaitFn = std::function<void(std::function<void()> const &)>;
+
+/**
+ * Reads a stream given by functions, e.g. a python file-like object or an iterator of byte chunks, or a file.
+ * - A worker reads ahead into a bounded buffer (the window), so decoding overlaps with bytes arriving and with
+ *   slow reads. 0 reads in the caller. Seeking out of the window drops it, the worker refills from the target.
+ * - Without a seek function the stream is sequential: it's probed by the demuxer,
+ *   and seeking only goes forward (by skipping bytes).
+ * */
+class AVStreamIOContext : public AVIOBase {
+public:
+    // Bytes read into buf (at most size), 0 at the end, < 0 for errors.
+    using ReadFn = std::function<int64_t(uint8_t * buf, int64_t size)>;
+    // Seeks to offset from SEEK_SET or SEEK_END, returns the position or < 0 for errors.
+    using SeekFn = std::function<int64_t(int64_t offset, int whence)>;
+
+    AVStreamIOContext(
+        ReadFn read_fn,
+        SeekFn seek_fn,
+        size_t readahead = kDefaultReadAhead,
+        WaitFn wait_fn = nullptr,
+        size_t buffer_size = DEFAULT_AVIO_BUFFER_SZ
+    );
+    ~AVStreamIOContext();
+
+    // Reads a local file ahead of the demuxer. nullptr if the file can't be opened.
+    static auto OpenFile(const std::string & filename, size_t readahead = kDefaultReadAhead) -> std::unique_ptr<AVIOBase>;
+
+    int read(unsigned char * buf, int buf_size);
+    int64_t seek(int64_t offset, int whence);
+    bool seekable() const override { return (bool)seek_fn_; }
+    auto stats() const -> IOStats override;
+
+    static int ReadStream(void * opaque, uint8_t * buf, int buf_size);
+    static int64_t SeekStream(void * opaque, int64_t offset, int whence);
+
+private:
+    ReadFn  read_fn_;
+    SeekFn  seek_fn_;
+    WaitFn  wait_fn_;
+    size_t  readahead_;
+    size_t  chunk_size_;
+    int64_t pos_;         // position of the next byte given to the demuxer
+    int64_t size_;        // cached, -1 if not known yet, -2 if unknown
+
+    // read-ahead, the source is only called with source_mutex_ held (before mutex_)
+    std::thread                      worker_;
+    std::mutex                       source_mutex_;
+    mutable std::mutex               mutex_;
+    std::condition_variable          cond_;
+    std::deque<std::vector<uint8_t>> chunks_;
+    size_t                           head_;      // bytes of the first chunk given out
+    size_t                           buffered_;  // bytes not given out
+    int64_t                          source_pos_;
+    bool                             eof_;
+    bool                             error_;
+    bool                             stop_;
+    // counters
+    uint64_t                         bytes_read_;
+    std::chrono::steady_clock::duration stall_;
+
+    void _readAhead();
+    auto _readBuffered(uint8_t * buf, int buf_size) -> int;
+    auto _skip(int64_t target) -> int64_t;
+    auto _size() -> int64_t;
+};
+
+}
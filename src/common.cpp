@@ -1,5 +1,6 @@
 #include "common.hpp"
 #include "log.hpp"
+#include "frame_pool.hpp"
 
 namespace vio {
 
@@ -61,4 +62,18 @@ AVFrame * AllocateFrame(enum AVPixelFormat pix_fmt, int width, int height) {
     return picture;
 }
 
+bool EnsureFrameWritable(AVFrame * frame) {
+    if (av_frame_is_writable(frame)) return true;
+    // New buffers come from the process-wide pool, the old ones go back to it when released.
+    return FramePool::Instance().getBuffer(frame);
+}
+
+size_t FrameBytes(AVFrame const * frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS; ++i) {
+        if (frame->buf[i]) bytes += frame->buf[i]->size;
+    }
+    return bytes;
+}
+
 }
\ No newline at end of file
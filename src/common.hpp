@@ -30,19 +30,19 @@ extern "C" {
 #define AV_TIME_BASE_Q AVRational {1, AV_TIME_BASE}
 
 inline char *av_ts2str(int64_t ts) {
-    static char str[AV_TS_MAX_STRING_SIZE];
+    thread_local static char str[AV_TS_MAX_STRING_SIZE];
     memset(str, 0, sizeof(str));
     return av_ts_make_string(str, ts);
 }
 
 inline char* av_err2str(int errnum) {
-    static char str[AV_ERROR_MAX_STRING_SIZE];
+    thread_local static char str[AV_ERROR_MAX_STRING_SIZE];
     memset(str, 0, sizeof(str));
     return av_make_error_string(str, AV_ERROR_MAX_STRING_SIZE, errnum);
 }
 
 inline char *av_ts2timestr(int64_t ts, AVRational tb) {
-    static char str[AV_TS_MAX_STRING_SIZE];
+    thread_local static char str[AV_TS_MAX_STRING_SIZE];
     memset(str, 0, sizeof(str));
     return av_ts_make_time_string(str, ts, &tb);
 }
@@ -105,4 +105,13 @@ AVFrame * AllocateFrame(enum AVSampleFormat sampleFmt, uint64_t channelLayout, i
 #endif
 AVFrame * AllocateFrame(enum AVPixelFormat pixFmt, int width, int height);
 
+// Make sure the frame owns its buffers exclusively before writing into it.
+// Unlike av_frame_make_writable(), the old content is NOT copied, the frame just gets new buffers
+// when the old ones are still referenced by others (e.g. exported to numpy without copying).
+// A frame without buffers gets them here, so buffers can be allocated lazily.
+bool EnsureFrameWritable(AVFrame * frame);
+
+// Bytes of the buffers referenced by the frame.
+size_t FrameBytes(AVFrame const * frame);
+
 }
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include "log.hpp"
+#include "converter.hpp"
+
+namespace vio {
+
+// Slices are not thinner than this, converting them in threads doesn't pay off.
+static const int kMinSliceRows = 32;
+
+// Vertical subsampling of a plane.
+static int _planeShiftY(AVPixFmtDescriptor const * desc, int plane) {
+    return (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+}
+
+// Can the format be cut into slices by plane pointers.
+static bool _sliceable(AVPixFmtDescriptor const * desc) {
+    return desc && !(desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM));
+}
+
+bool FrameConverter::init(
+    int src_w, int src_h, AVPixelFormat src_fmt,
+    int dst_w, int dst_h, AVPixelFormat dst_fmt,
+    int flags, int threads
+) {
+    this->reset();
+    src_w_ = src_w; src_h_ = src_h; src_fmt_ = src_fmt;
+    dst_w_ = dst_w; dst_h_ = dst_h; dst_fmt_ = dst_fmt;
+    flags_   = flags;
+    threads_ = std::max(threads, 1);
+    if (fast_path_ && src_w == dst_w && src_h == dst_h) {
+        yuv2rgb_.init(src_fmt, dst_fmt, colorspace_, range_);
+    }
+    return this->_createSlices();
+}
+
+void FrameConverter::reset() {
+    yuv2rgb_ = YuvToRgb();
+    pool_.reset();
+    for (auto & slice : slices_) {
+        sws_freeContext(slice.ctx);
+    }
+    slices_.clear();
+}
+
+bool FrameConverter::setCrop(int x, int y) {
+    auto const * desc = av_pix_fmt_desc_get(src_fmt_);
+    if ((x != 0 || y != 0) && !_sliceable(desc)) {
+        spdlog::error("[vio::FrameConverter]: Cannot crop images of {}", (desc) ? desc->name : "none");
+        return false;
+    }
+    crop_x_ = x;
+    crop_y_ = y;
+    return true;
+}
+
+bool FrameConverter::setThreads(int threads) {
+    threads = std::max(threads, 1);
+    if (threads == threads_) {
+        return true;
+    }
+    threads_ = threads;
+    if (!this->valid()) {
+        return true;
+    }
+    pool_.reset();
+    for (auto & slice : slices_) {
+        sws_freeContext(slice.ctx);
+    }
+    slices_.clear();
+    return this->_createSlices();
+}
+
+bool FrameConverter::_createSlices() {
+    auto const * src_desc = av_pix_fmt_desc_get(src_fmt_);
+    auto const * dst_desc = av_pix_fmt_desc_get(dst_fmt_);
+
+    // Slicing is for unscaled conversion, so that rows of slices map one-to-one. Scaling filters
+    // (e.g. the vertical chroma interpolation of a width change) would see slice edges as image edges.
+    int n = 1;
+    int align = 1;
+    if (threads_ > 1 && yuv2rgb_.valid()) {
+        align = 2;
+        n = std::max(std::min(threads_, src_h_ / kMinSliceRows), 1);
+    }
+    else if (threads_ > 1 && src_w_ == dst_w_ && src_h_ == dst_h_ && _sliceable(src_desc) && _sliceable(dst_desc)) {
+        align = 1 << std::max(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+        n = std::max(std::min(threads_, src_h_ / kMinSliceRows), 1);
+    }
+    else if (threads_ > 1) {
+        static std::atomic<bool> s_logged(false);
+        if (!s_logged.exchange(true)) {
+            spdlog::info("[vio::FrameConverter]: Scaled (or unsliceable) conversion is single-threaded, "
+                         "convert_threads only applies to unscaled conversion.");
+        }
+    }
+
+    int rows = (src_h_ / n) / align * align;
+    int y = 0;
+    for (int i = 0; i < n; ++i) {
+        int h = (i + 1 < n) ? rows : src_h_ - y;
+        int dst_h = (n > 1) ? h : dst_h_;
+        if (yuv2rgb_.valid()) {
+            slices_.push_back({ y, h, y, dst_h, nullptr });
+            y += h;
+            continue;
+        }
+        SwsContext * ctx = sws_getContext(
+            src_w_, h, src_fmt_,
+            dst_w_, dst_h, dst_fmt_,
+            flags_, NULL, NULL, NULL
+        );
+        if (!ctx) {
+            spdlog::error("[vio::FrameConverter]: Could not initialize the sws context");
+            this->reset();
+            return false;
+        }
+        this->_setColorspaceDetails(ctx);
+        slices_.push_back({ y, h, y, dst_h, ctx });
+        y += h;
+    }
+
+    if (slices_.size() > 1) {
+        pool_.reset(new ThreadPool(slices_.size() - 1));
+    }
+    return true;
+}
+
+void FrameConverter::_setColorspaceDetails(SwsContext * ctx) const {
+    int * inv_table = nullptr, * table = nullptr;
+    int src_range = 0, dst_range = 0, brightness = 0, contrast = 0, saturation = 0;
+    if (sws_getColorspaceDetails(ctx, &inv_table, &src_range, &table, &dst_range, &brightness, &contrast, &saturation) < 0) {
+        return;  // not from yuv
+    }
+
+    int sws_cs = SWS_CS_DEFAULT;
+    switch (colorspace_) {
+    case AVCOL_SPC_BT709:      sws_cs = SWS_CS_ITU709;    break;
+    case AVCOL_SPC_FCC:        sws_cs = SWS_CS_FCC;       break;
+    case AVCOL_SPC_SMPTE240M:  sws_cs = SWS_CS_SMPTE240M; break;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:  sws_cs = SWS_CS_BT2020;    break;
+    default: break;
+    }
+    if (range_ != AVCOL_RANGE_UNSPECIFIED) {
+        src_range = (range_ == AVCOL_RANGE_JPEG) ? 1 : 0;
+    }
+    sws_setColorspaceDetails(ctx, sws_getCoefficients(sws_cs), src_range, table, dst_range, brightness, contrast, saturation);
+}
+
+void FrameConverter::_convertSlice(
+    Slice const & slice,
+    uint8_t const * const src[], int const src_stride[],
+    uint8_t * const dst[], int const dst_stride[]
+) {
+    if (!slice.ctx) {
+        yuv2rgb_.convert(src, src_stride, dst[0], dst_stride[0], src_w_, slice.src_y, slice.src_h);
+        return;
+    }
+
+    auto const * src_desc = av_pix_fmt_desc_get(src_fmt_);
+    auto const * dst_desc = av_pix_fmt_desc_get(dst_fmt_);
+
+    uint8_t const * src_data[4] = { nullptr, nullptr, nullptr, nullptr };
+    uint8_t       * dst_data[4] = { nullptr, nullptr, nullptr, nullptr };
+    for (int p = 0; p < 4; ++p) {
+        if (src[p]) src_data[p] = src[p] + (ptrdiff_t)(slice.src_y >> _planeShiftY(src_desc, p)) * src_stride[p];
+        if (dst[p]) dst_data[p] = dst[p] + (ptrdiff_t)(slice.dst_y >> _planeShiftY(dst_desc, p)) * dst_stride[p];
+    }
+    sws_scale(slice.ctx, src_data, src_stride, 0, slice.src_h, dst_data, dst_stride);
+}
+
+void FrameConverter::convert(
+    uint8_t const * const src_planes[], int const src_stride[],
+    uint8_t * const dst[], int const dst_stride[]
+) {
+    // Crop in place: point to the top-left of the crop in each plane.
+    uint8_t const * cropped[4] = { src_planes[0], src_planes[1], src_planes[2], src_planes[3] };
+    if (crop_x_ != 0 || crop_y_ != 0) {
+        auto const * desc = av_pix_fmt_desc_get(src_fmt_);
+        for (int c = 0; c < desc->nb_components; ++c) {
+            auto const & comp = desc->comp[c];
+            bool chroma = (c == 1 || c == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+            int x = crop_x_ >> ((chroma) ? desc->log2_chroma_w : 0);
+            int y = crop_y_ >> ((chroma) ? desc->log2_chroma_h : 0);
+            cropped[comp.plane] = src_planes[comp.plane] + (ptrdiff_t)y * src_stride[comp.plane] + (ptrdiff_t)x * comp.step;
+        }
+    }
+    uint8_t const * const * src = cropped;
+
+    if (slices_.size() == 1) {
+        if (slices_[0].ctx) {
+            sws_scale(slices_[0].ctx, src, src_stride, 0, src_h_, dst, dst_stride);
+        }
+        else {
+            yuv2rgb_.convert(src, src_stride, dst[0], dst_stride[0], src_w_, 0, src_h_);
+        }
+        return;
+    }
+    pool_->run((int)slices_.size(), [&](int i) {
+        this->_convertSlice(slices_[i], src, src_stride, dst, dst_stride);
+    });
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+
+#include "common.hpp"
+#include "thread_pool.hpp"
+#include "yuv2rgb.hpp"
+
+namespace vio {
+
+/**
+ * Pixel format conversion (and resizing) of images, with swscale.
+ * Without resizing, the image is split into horizontal slices, converted in parallel.
+ * Resizing is single-threaded, whatever the number of threads (logged once).
+ * Each slice has its own SwsContext, as an independent image of the slice height.
+ * yuv420p / nv12 into packed rgb at the same size are converted by the simd kernels of YuvToRgb instead.
+ * A crop of the source is converted by offsetting the plane pointers, the source size is the crop size then.
+ * */
+class FrameConverter {
+public:
+    FrameConverter()
+        : src_w_(0), src_h_(0), src_fmt_(AV_PIX_FMT_NONE)
+        , dst_w_(0), dst_h_(0), dst_fmt_(AV_PIX_FMT_NONE)
+        , flags_(0), threads_(1)
+        , colorspace_(AVCOL_SPC_UNSPECIFIED), range_(AVCOL_RANGE_UNSPECIFIED)
+        , fast_path_(true)
+        , crop_x_(0), crop_y_(0)
+    {}
+    ~FrameConverter() { this->reset(); }
+    FrameConverter(FrameConverter const &) = delete;
+    FrameConverter & operator=(FrameConverter const &) = delete;
+
+    bool init(int src_w, int src_h, AVPixelFormat src_fmt,
+              int dst_w, int dst_h, AVPixelFormat dst_fmt,
+              int flags = SWS_BICUBIC, int threads = 1);
+    void reset();
+    bool valid() const { return !slices_.empty(); }
+
+    // Colour matrix and range of the source, set before init(). Unspecified ones follow swscale's defaults.
+    void setColorspace(AVColorSpace colorspace, AVColorRange range) { colorspace_ = colorspace; range_ = range; }
+    // Use the simd kernels when possible, set before init().
+    void setFastPath(bool enable) { fast_path_ = enable; }
+    auto isFastPath() const -> bool { return yuv2rgb_.valid(); }
+
+    // Top-left of the crop in source images, aligned to the chroma subsampling. False if the format can't be cropped.
+    bool setCrop(int x, int y);
+
+    // Number of threads to convert with, the image is not sliced with 1. Re-create the contexts if needed.
+    bool setThreads(int threads);
+    auto threads() const -> int { return threads_; }
+    auto numSlices() const -> int { return (int)slices_.size(); }
+
+    void convert(uint8_t const * const src[], int const src_stride[], uint8_t * const dst[], int const dst_stride[]);
+
+private:
+    struct Slice {
+        int src_y, src_h;
+        int dst_y, dst_h;
+        SwsContext * ctx;  // nullptr for the fast path
+    };
+
+    int src_w_, src_h_;
+    AVPixelFormat src_fmt_;
+    int dst_w_, dst_h_;
+    AVPixelFormat dst_fmt_;
+    int flags_;
+    int threads_;
+    AVColorSpace colorspace_;
+    AVColorRange range_;
+    bool fast_path_;
+    int crop_x_, crop_y_;
+    YuvToRgb yuv2rgb_;
+    std::vector<Slice> slices_;
+    std::unique_ptr<ThreadPool> pool_;
+
+    bool _createSlices();
+    void _setColorspaceDetails(SwsContext * ctx) const;
+    void _convertSlice(Slice const & slice, uint8_t const * const src[], int const src_stride[], uint8_t * const dst[], int const dst_stride[]);
+};
+
+}
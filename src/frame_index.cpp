@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "log.hpp"
+#include "frame_index.hpp"
+
+namespace vio {
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                  Index File                                                    * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+// Layout: header | PacketEntry[num_packets] | int32 key_of_packet[num_packets] | int32 display_order[num_frames]
+struct IndexFileHeader {
+    char    magic[8];
+    int32_t version;
+    int32_t entry_size;
+    int64_t source_size;
+    int64_t source_mtime;
+    int32_t stream_idx;
+    int32_t num_packets;
+    int32_t num_frames;
+    int32_t reserved;
+};
+
+static const char    kIndexMagic[8]    = { 'V', 'I', 'O', 'I', 'D', 'X', '\0', '\0' };
+static const int32_t kIndexVersion     = 1;
+
+static int _processId() {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return (int)getpid();
+#endif
+}
+
+static std::string _absolutePath(std::string const & filename) {
+#ifdef _WIN32
+    char abs_path[_MAX_PATH];
+    return (_fullpath(abs_path, filename.c_str(), _MAX_PATH)) ? std::string(abs_path) : filename;
+#else
+    char abs_path[PATH_MAX];
+    return (realpath(filename.c_str(), abs_path)) ? std::string(abs_path) : filename;
+#endif
+}
+
+bool SourceStat::Get(std::string const & filename, SourceStat & stat) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    stat.size  = (int64_t)st.st_size;
+    stat.mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    stat.size = (int64_t)st.st_size;
+#if defined(__APPLE__)
+    stat.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stat.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
+
+std::string FrameIndex::CachePath(std::string const & cache_dir, std::string const & filename, SourceStat const & stat) {
+    // Key with absolute path, size and mtime. (FNV-1a 64)
+    std::string key = _absolutePath(filename);
+    key += "|" + std::to_string(stat.size) + "|" + std::to_string(stat.mtime);
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= UINT64_C(0x100000001b3);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.vioidx", (unsigned long long)hash);
+    return (cache_dir.empty() || cache_dir.back() == '/') ? cache_dir + name : cache_dir + "/" + name;
+}
+
+bool FrameIndex::save(std::string const & path, int stream_idx, SourceStat const & stat) const {
+    if (this->empty()) {
+        return false;
+    }
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.version      = kIndexVersion;
+    header.entry_size   = (int32_t)sizeof(PacketEntry);
+    header.source_size  = stat.size;
+    header.source_mtime = stat.mtime;
+    header.stream_idx   = stream_idx;
+    header.num_packets  = num_packets_;
+    header.num_frames   = num_frames_;
+
+    // Write into a temporary file then rename, other processes never see a partial file.
+    std::string tmp_path = path + ".tmp." + std::to_string(_processId());
+    FILE * fp = fopen(tmp_path.c_str(), "wb");
+    if (!fp) {
+        spdlog::warn("[vio::FrameIndex]: Cannot write index file '{}'.", tmp_path);
+        return false;
+    }
+    bool ok = (
+        fwrite(&header,        sizeof(header),      1,            fp) == 1 &&
+        fwrite(packets_,       sizeof(PacketEntry), num_packets_, fp) == (size_t)num_packets_ &&
+        fwrite(key_of_packet_, sizeof(int32_t),     num_packets_, fp) == (size_t)num_packets_ &&
+        fwrite(display_order_, sizeof(int32_t),     num_frames_,  fp) == (size_t)num_frames_
+    );
+    ok = (fclose(fp) == 0) && ok;
+    if (ok) {
+#ifdef _WIN32
+        remove(path.c_str());  // rename doesn't replace on windows, readers missing it meanwhile rebuild
+#endif
+        ok = (rename(tmp_path.c_str(), path.c_str()) == 0);
+    }
+    if (!ok) {
+        spdlog::warn("[vio::FrameIndex]: Failed to write index file '{}'.", path);
+        remove(tmp_path.c_str());
+    }
+    return ok;
+}
+
+bool FrameIndex::load(std::string const & path, int stream_idx, SourceStat const & stat) {
+    this->clear();
+
+    void const * file = nullptr;
+    size_t file_size = 0;
+#ifdef _WIN32
+    // No mmap, the file is read into memory.
+    FILE * fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    long size = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : -1;
+    bool ok = size >= (long)sizeof(IndexFileHeader) && fseek(fp, 0, SEEK_SET) == 0;
+    if (ok) {
+        file_data_.resize((size_t)size);
+        ok = fread(file_data_.data(), 1, (size_t)size, fp) == (size_t)size;
+    }
+    fclose(fp);
+    if (!ok) {
+        this->clear();
+        return false;
+    }
+    file = file_data_.data();
+    file_size = file_data_.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void * map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(IndexFileHeader)) {
+        map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);  // the mapping is still valid.
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    map_ = map;
+    map_size_ = (size_t)st.st_size;
+    file = map_;
+    file_size = map_size_;
+#endif
+
+    // Check the header and size.
+    auto const * header = static_cast<IndexFileHeader const *>(file);
+    size_t expected = sizeof(IndexFileHeader)
+        + (sizeof(PacketEntry) + sizeof(int32_t)) * (size_t)std::max(header->num_packets, 0)
+        + sizeof(int32_t) * (size_t)std::max(header->num_frames, 0);
+    if (memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+        header->version      != kIndexVersion ||
+        header->entry_size   != (int32_t)sizeof(PacketEntry) ||
+        header->source_size  != stat.size ||
+        header->source_mtime != stat.mtime ||
+        header->stream_idx   != stream_idx ||
+        header->num_packets  <= 0 ||
+        header->num_frames   <= 0 ||
+        header->num_frames   >  header->num_packets ||
+        file_size != expected) {
+        this->clear();
+        return false;
+    }
+
+    auto const * data = static_cast<uint8_t const *>(file) + sizeof(IndexFileHeader);
+    num_packets_   = header->num_packets;
+    num_frames_    = header->num_frames;
+    packets_       = reinterpret_cast<PacketEntry const *>(data);
+    key_of_packet_ = reinterpret_cast<int32_t const *>(data + sizeof(PacketEntry) * num_packets_);
+    display_order_ = key_of_packet_ + num_packets_;
+    return true;
+}
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                    Building                                                    * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+void FrameIndex::clear() {
+    packets_       = nullptr;
+    key_of_packet_ = nullptr;
+    display_order_ = nullptr;
+    num_packets_   = 0;
+    num_frames_    = 0;
+    packets_data_.clear();
+    key_of_packet_data_.clear();
+    display_order_data_.clear();
+    file_data_.clear();
+#ifndef _WIN32
+    if (map_) {
+        munmap(map_, map_size_);
+    }
+#endif
+    map_ = nullptr;
+    map_size_ = 0;
+}
+
+bool FrameIndex::build(AVFormatContext * fmt, int stream_idx) {
+    this->clear();
+
+    // Only demux the indexed stream.
+    std::vector<AVDiscard> discards(fmt->nb_streams);
+    for (size_t i = 0; i < fmt->nb_streams; ++i) {
+        discards[i] = fmt->streams[i]->discard;
+        if ((int)i != stream_idx) {
+            fmt->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    AVPacket * pkt = av_packet_alloc();
+    bool valid = (pkt != nullptr);
+    int ret = 0;
+    while (valid && (ret = av_read_frame(fmt, pkt)) >= 0) {
+        if (pkt->stream_index == stream_idx) {
+            PacketEntry e;
+            e.pts      = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+            e.dts      = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+            e.pos      = pkt->pos;
+            e.flags    = pkt->flags;
+            e.reserved = 0;
+            if (e.pts == AV_NOPTS_VALUE) {
+                spdlog::warn("[vio::FrameIndex]: Packet {} has no timestamp, cannot index.", packets_data_.size());
+                valid = false;
+            }
+            packets_data_.push_back(e);
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+
+    for (size_t i = 0; i < fmt->nb_streams; ++i) {
+        fmt->streams[i]->discard = discards[i];
+    }
+
+    if (valid && ret != AVERROR_EOF) {
+        spdlog::warn("[vio::FrameIndex]: Failed to read packet: {}.", av_err2str(ret));
+        valid = false;
+    }
+    if (!valid) {
+        this->clear();
+        return false;
+    }
+
+    this->_finalize();
+    return !this->empty();
+}
+
+void FrameIndex::_finalize() {
+    auto const & packets = packets_data_;
+    int32_t n = (int32_t)packets.size();
+
+    key_of_packet_data_.resize(n);
+    int32_t last_key = -1;
+    for (int32_t i = 0; i < n; ++i) {
+        if (packets[i].isKey()) last_key = i;
+        key_of_packet_data_[i] = last_key;
+    }
+
+    display_order_data_.clear();
+    display_order_data_.reserve(n);
+    for (int32_t i = 0; i < n; ++i) {
+        if (!packets[i].isDiscard()) display_order_data_.push_back(i);
+    }
+    std::stable_sort(display_order_data_.begin(), display_order_data_.end(), [&packets](int32_t a, int32_t b) {
+        return packets[a].pts < packets[b].pts;
+    });
+
+    packets_       = packets_data_.data();
+    key_of_packet_ = key_of_packet_data_.data();
+    display_order_ = display_order_data_.data();
+    num_packets_   = n;
+    num_frames_    = (int32_t)display_order_data_.size();
+}
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                     Query                                                      * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+int64_t FrameIndex::framePts(int32_t frame_idx) const {
+    if (frame_idx < 0 || frame_idx >= num_frames_) {
+        return AV_NOPTS_VALUE;
+    }
+    return packets_[display_order_[frame_idx]].pts;
+}
+
+int32_t FrameIndex::frameIndex(int64_t pts) const {
+    auto const * begin = display_order_;
+    auto const * end   = display_order_ + num_frames_;
+    auto const * it = std::upper_bound(begin, end, pts, [this](int64_t ts, int32_t i) {
+        return ts < packets_[i].pts;
+    });
+    int32_t frame_idx = (int32_t)(it - begin) - 1;
+    return std::max(frame_idx, (int32_t)0);
+}
+
+int32_t FrameIndex::seekPacket(int32_t frame_idx) const {
+    if (frame_idx < 0 || frame_idx >= num_frames_) {
+        return -1;
+    }
+
+    auto p   = display_order_[frame_idx];
+    auto pts = packets_[p].pts;
+    auto k   = key_of_packet_[p];
+    // Leading frames of an open GOP are displayed before its key frame,
+    // they depend on the previous GOP.
+    while (k > 0 && packets_[k].pts > pts) {
+        k = key_of_packet_[k - 1];
+    }
+    return std::max(k, (int32_t)0);
+}
+
+}
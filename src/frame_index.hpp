@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "common.hpp"
+
+namespace vio {
+
+// One demuxed packet of the indexed stream. Timestamps are in the time base of the stream.
+struct PacketEntry {
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;    // byte offset in the input, -1 if unknown.
+    int32_t flags;  // AV_PKT_FLAG_*
+    int32_t reserved;
+
+    bool isKey()     const { return (flags & AV_PKT_FLAG_KEY)     != 0; }
+    bool isDiscard() const { return (flags & AV_PKT_FLAG_DISCARD) != 0; }
+};
+
+// Identity of the indexed file, a cached index is valid only for the same one.
+struct SourceStat {
+    int64_t size  = -1;
+    int64_t mtime = -1;  // nanoseconds
+
+    static bool Get(std::string const & filename, SourceStat & stat);
+};
+
+/**
+ * Packet index of a stream, built by a demux-only pass.
+ * - Packets are kept in decoding order.
+ * - Frame indices follow the presentation order (sorted pts) of packets, discarded packets excluded.
+ * The index can be saved into a compact binary file, which is memory-mapped when loading.
+ * */
+class FrameIndex {
+public:
+    FrameIndex()
+        : packets_(nullptr), key_of_packet_(nullptr), display_order_(nullptr)
+        , num_packets_(0), num_frames_(0)
+        , map_(nullptr), map_size_(0)
+    {}
+    ~FrameIndex() { this->clear(); }
+    FrameIndex(FrameIndex const &) = delete;
+    FrameIndex & operator=(FrameIndex const &) = delete;
+
+    // Scan all packets of the stream. The format context is left at eof, caller should seek back.
+    bool build(AVFormatContext * fmt, int stream_idx);
+    void clear();
+
+    // Binary index file.
+    bool save(std::string const & path, int stream_idx, SourceStat const & stat) const;
+    bool load(std::string const & path, int stream_idx, SourceStat const & stat);
+    // Path of the index file for 'filename' in a cache directory, keyed by path, size and mtime.
+    static std::string CachePath(std::string const & cache_dir, std::string const & filename, SourceStat const & stat);
+
+    bool empty()     const { return num_frames_ == 0; }
+    auto numFrames() const -> int32_t { return num_frames_; }
+    auto numPackets() const -> int32_t { return num_packets_; }
+    auto packet(int32_t i) const -> PacketEntry const & { return packets_[i]; }
+
+    // Frame index <-> pts
+    auto framePts(int32_t frame_idx) const -> int64_t;
+    auto frameIndex(int64_t pts) const -> int32_t;  // the last frame with pts <= given pts
+
+    // Decoding order (packet index) of a frame.
+    auto decodeOrder(int32_t frame_idx) const -> int32_t { return display_order_[frame_idx]; }
+    // The key packet to seek to, from where the frame can be decoded correctly. -1 if frame_idx is invalid.
+    auto seekPacket(int32_t frame_idx) const -> int32_t;
+
+private:
+    // Views of the index, point to either the owned vectors or the mapped file.
+    PacketEntry const * packets_;        // decoding order
+    int32_t     const * key_of_packet_;  // last key packet (at or before) of each packet, -1 if none
+    int32_t     const * display_order_;  // frame index -> packet index
+    int32_t num_packets_;
+    int32_t num_frames_;
+
+    std::vector<PacketEntry> packets_data_;
+    std::vector<int32_t>     key_of_packet_data_;
+    std::vector<int32_t>     display_order_data_;
+
+    void * map_;
+    size_t map_size_;
+    std::vector<uint8_t> file_data_;  // the loaded file where it can't be mapped (windows)
+
+    void _finalize();
+};
+
+}
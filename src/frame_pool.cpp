@@ -0,0 +1,118 @@
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+}
+
+#include "log.hpp"
+#include "frame_pool.hpp"
+
+namespace vio {
+
+// Same alignment as av_frame_get_buffer(frame, 32) in AllocateFrame().
+static const int kBufferAlign = 32;
+
+// Opaque of a pool (and its buffers), freed after all buffers of the pool.
+struct PoolOpaque {
+    FramePool * owner;
+    size_t      size;
+};
+
+FramePool & FramePool::Instance() {
+    // Never destroyed, buffers may be returned during exiting (e.g. by arrays still referencing them).
+    static FramePool * instance = new FramePool();
+    return *instance;
+}
+
+AVBufferRef * FramePool::_alloc(void * opaque, BufferSize size) {
+    auto * po = static_cast<PoolOpaque *>(opaque);
+    auto * data = static_cast<uint8_t *>(av_malloc(size));
+    if (!data) {
+        return nullptr;
+    }
+    AVBufferRef * buf = av_buffer_create(data, size, &FramePool::_free, opaque, 0);
+    if (!buf) {
+        av_free(data);
+        return nullptr;
+    }
+    po->owner->pooled_ += po->size;
+    return buf;
+}
+
+void FramePool::_free(void * opaque, uint8_t * data) {
+    auto * po = static_cast<PoolOpaque *>(opaque);
+    po->owner->pooled_ -= po->size;
+    av_free(data);
+}
+
+void FramePool::_freePool(void * opaque) {
+    delete static_cast<PoolOpaque *>(opaque);
+}
+
+bool FramePool::getBuffer(AVFrame * frame) {
+    auto pix_fmt = (AVPixelFormat)frame->format;
+    auto width   = frame->width;
+    auto height  = frame->height;
+    av_frame_unref(frame);
+    frame->format = pix_fmt;
+    frame->width  = width;
+    frame->height = height;
+    frame->pts    = AV_NOPTS_VALUE;
+
+    int size = av_image_get_buffer_size(pix_fmt, width, height, kBufferAlign);
+    if (size <= 0) {
+        spdlog::error("[vio::FramePool]: Invalid image {}x{} of format {}.", width, height, (int)pix_fmt);
+        return false;
+    }
+    // Over the limit, give back idle buffers (of other sizes) first.
+    if (limit_ > 0 && this->used() + (size_t)size > limit_) {
+        this->trim();
+    }
+
+    AVBufferRef * buf = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto & pool = pools_[(size_t)size];
+        if (!pool) {
+            auto * po = new PoolOpaque{this, (size_t)size};
+            pool = av_buffer_pool_init2(size, po, &FramePool::_alloc, &FramePool::_freePool);
+            if (!pool) {
+                delete po;
+                pools_.erase((size_t)size);
+            }
+        }
+        if (pool) {
+            buf = av_buffer_pool_get(pool);
+        }
+    }
+    if (!buf) {
+        spdlog::error("[vio::FramePool]: Failed to allocate a buffer of {} bytes.", size);
+        return false;
+    }
+
+    frame->buf[0] = buf;
+    av_image_fill_arrays(frame->data, frame->linesize, buf->data, pix_fmt, width, height, kBufferAlign);
+    frame->extended_data = frame->data;
+    return true;
+}
+
+void FramePool::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Idle buffers are freed at once, the ones in use are freed when returned.
+    for (auto & kv : pools_) {
+        av_buffer_pool_uninit(&kv.second);
+    }
+    pools_.clear();
+}
+
+bool FramePool::reserve(size_t bytes) {
+    size_t limit = limit_;
+    size_t cur = reserved_;
+    do {
+        if (limit > 0 && pooled_ + cur + bytes > limit) {
+            return false;
+        }
+    } while (!reserved_.compare_exchange_weak(cur, cur + bytes));
+    return true;
+}
+
+}
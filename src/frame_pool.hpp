@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+}
+
+#include "common.hpp"
+
+namespace vio {
+
+/**
+ * Process-wide pool of image buffers, shared by all readers.
+ * - Buffers are pooled by size, a returned buffer is reused by any reader needing the same size.
+ * - Frame memory is accounted against a per-process limit of caches: pooled buffers, plus frames held by caches.
+ *   Pooled buffers are always given out, the caches shrink (or refuse frames) to stay in the limit.
+ *   It's a budget of caching, not a cap of memory: frames owned by decoders are neither pooled nor counted.
+ * */
+class FramePool {
+public:
+    static FramePool & Instance();
+
+    FramePool(FramePool const &) = delete;
+    FramePool & operator=(FramePool const &) = delete;
+
+    // Get buffers for the frame, whose format, width and height are set. Its old buffers are unreferenced.
+    bool getBuffer(AVFrame * frame);
+    // Free the idle pooled buffers.
+    void trim();
+
+    // The per-process limit of frame caches in bytes (with pooled buffers), 0 for no limit.
+    void setLimit(size_t bytes) { limit_ = bytes; }
+    auto limit()  const -> size_t { return limit_; }
+    auto used()   const -> size_t { return pooled_ + reserved_; }
+    auto pooled() const -> size_t { return pooled_; }
+
+    // Account memory held out of the pool (e.g. cached frames). False if it would exceed the limit.
+    bool reserve(size_t bytes);
+    void release(size_t bytes) { reserved_ -= bytes; }
+
+private:
+    FramePool() : limit_(0), pooled_(0), reserved_(0) {}
+
+    std::mutex mutex_;
+    std::unordered_map<size_t, AVBufferPool *> pools_;  // buffer size -> pool
+    std::atomic<size_t> limit_;
+    std::atomic<size_t> pooled_;
+    std::atomic<size_t> reserved_;
+
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+    using BufferSize = size_t;
+#else
+    using BufferSize = int;
+#endif
+    static AVBufferRef * _alloc(void * opaque, BufferSize size);
+    static void _free(void * opaque, uint8_t * data);
+    static void _freePool(void * opaque);
+};
+
+}
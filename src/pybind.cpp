@@ -1,15 +1,22 @@
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
+#include <cstring>
 #include <map>
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+}
+#include "avio_stream.hpp"
 #include "video_reader.hpp"
 #include "video_writer.hpp"
+#include "frame_pool.hpp"
 
 namespace py = pybind11;
 using namespace pybind11::literals;
 
 using NpImage = py::array_t<uint8_t, py::array::c_style>;
-using NpBytes = py::array_t<uint8_t, py::array::c_style>;
+using NpFrame = py::array_t<uint8_t>;  // may be strided
 
 auto _CheckInputPixFmt(std::string pix_fmt) -> std::string {
     if      (pix_fmt == "rgb24" || pix_fmt == "bgr24") { return pix_fmt; }
@@ -19,11 +26,108 @@ auto _CheckInputPixFmt(std::string pix_fmt) -> std::string {
     return "";
 }
 
-auto _Read(vio::VideoReader & reader) -> std::pair<bool, NpImage> {
+// Readers also output luma only, or planar yuv ("yuv" for the decoded one).
+auto _CheckOutputPixFmt(std::string pix_fmt) -> std::string {
+    if      (pix_fmt == "gray" || pix_fmt == "gray8") { return "gray"; }
+    else if (pix_fmt == vio::kNativeYuv || pix_fmt == "nv12") { return pix_fmt; }
+    else if (pix_fmt == "yuv420p" || pix_fmt == "yuv422p" || pix_fmt == "yuv444p") { return pix_fmt; }
+    return _CheckInputPixFmt(pix_fmt);
+}
+
+// Shape and dtype of a frame of the output spec. Planar frames are packed bytes.
+auto _OutputShape(vio::VideoReader const & reader) -> std::vector<py::ssize_t> {
+    if (reader.isPlanar()) {
+        return { (py::ssize_t)reader.outputBytes() };
+    }
+    auto const size = reader.imageSize();
+    py::ssize_t const h = size.second, w = size.first, c = reader.pixelBytes();
+    if (reader.output().layout == vio::TensorLayout::HWC) { return { h, w, c }; }
+    return { c, h, w };
+}
+
+auto _OutputDType(vio::VideoReader const & reader) -> py::dtype {
+    auto const dtype = reader.output().dtype;
+    if      (dtype == vio::TensorDType::Float32) { return py::dtype::of<float>(); }
+    else if (dtype == vio::TensorDType::Float16) { return py::dtype("float16"); }
+    return py::dtype::of<uint8_t>();
+}
+
+// New c-contiguous array for frames of the output spec, with leading dims (e.g. batch).
+auto _NewOutput(vio::VideoReader const & reader, std::vector<py::ssize_t> shape) -> py::array {
+    auto const frame_shape = _OutputShape(reader);
+    shape.insert(shape.end(), frame_shape.begin(), frame_shape.end());
+    return py::array(_OutputDType(reader), shape);
+}
+
+// Check the array given to read a frame into, returns the linesize of rows or -1 if it's invalid.
+// Images may have padded rows, other outputs must be c-contiguous.
+auto _OutputLinesize(vio::VideoReader const & reader, py::array const & out) -> int {
+    auto const shape = _OutputShape(reader);
+    auto const dtype = _OutputDType(reader);
+    bool ok = out.writeable() && out.ndim() == (py::ssize_t)shape.size() &&
+              out.dtype().kind() == dtype.kind() && out.itemsize() == dtype.itemsize();
+    for (size_t i = 0; ok && i < shape.size(); ++i) {
+        ok = out.shape(i) == shape[i];
+    }
+    if (!ok) {
+        spdlog::error(
+            "[videoio,pybind] Output array should be writable, of shape {} and dtype {}!",
+            std::string(py::str(py::tuple(py::cast(shape)))), std::string(py::str(dtype))
+        );
+        return -1;
+    }
+
+    if (reader.output().isImage() && !reader.isPlanar()) {
+        if (out.strides(1) == shape[2] && out.strides(2) == 1 && out.strides(0) >= shape[1] * shape[2]) {
+            return (int)out.strides(0);
+        }
+    }
+    else if (out.flags() & py::array::c_style) {
+        return 0;
+    }
+    spdlog::error("[videoio,pybind] Output array should be c-contiguous (images may have padded rows)!");
+    return -1;
+}
+
+bool _ReadInto(vio::VideoReader & reader, py::array & out) {
+    int linesize = _OutputLinesize(reader, out);
+    if (linesize < 0) return false;
+    auto * data = static_cast<uint8_t *>(out.mutable_data());
+    py::gil_scoped_release release;
+    return reader.readInto(data, linesize);
+}
+
+bool _SeekAndReadInto(vio::VideoReader & reader, int32_t frame_idx, py::array & out) {
+    int linesize = _OutputLinesize(reader, out);
+    if (linesize < 0) return false;
+    auto * data = static_cast<uint8_t *>(out.mutable_data());
+    py::gil_scoped_release release;
+    return reader.seekAndReadInto(frame_idx, data, linesize);
+}
+
+auto _Read(vio::VideoReader & reader, bool zero_copy) -> std::pair<bool, py::array> {
     static size_t shape_empty[3] = { 0, 0, 0 };
     static NpImage empty(shape_empty);
 
-    bool got = reader.read();
+    if (!zero_copy || !reader.output().isImage() || reader.isPlanar()) {
+        // Converted straight into the new array.
+        py::array ret = _NewOutput(reader, {});
+        bool got = false;
+        {
+            py::gil_scoped_release release;
+            got = reader.readInto(static_cast<uint8_t *>(ret.mutable_data()));
+        }
+        if (!got) {
+            return {false, empty};
+        }
+        return {true, std::move(ret)};
+    }
+
+    bool got = false;
+    {
+        py::gil_scoped_release release;
+        got = reader.read();
+    }
     if (!got) {
         return {false, empty};
     }
@@ -33,38 +137,245 @@ auto _Read(vio::VideoReader & reader) -> std::pair<bool, NpImage> {
     // get data
     auto const h = frame->height;
     auto const w = frame->width;
-    auto const s = frame->linesize[0];
-    // snow::log::warn("h {}, w {}, s{}\n", h, w, s);
+    auto const chs = reader.pixelBytes();  // the frame may be the decoded one (e.g. luma plane for gray)
 
-    int chs = s / w;  // TODO: channels
-    size_t shape[3] = { (size_t)h, (size_t)w, (size_t)chs };
-    NpImage ret(shape);
-    for (int y = 0; y < h; ++y) {
-        memcpy(ret.mutable_data() + (w * chs * y), frame->data[0] + s * y, w * chs);
+    // The array shares the (refcounted) buffer of the frame, and holds a reference until it dies.
+    // Rows keep the linesize of ffmpeg, so the array may be not c-contiguous.
+    AVFrame * ref = av_frame_clone(frame);
+    if (!ref) {
+        spdlog::error("[videoio,pybind] Failed to reference the frame!");
+        return {false, empty};
     }
+    py::capsule owner(ref, [](void * p) {
+        auto * f = static_cast<AVFrame *>(p);
+        av_frame_free(&f);
+    });
+    NpFrame ret(
+        { (py::ssize_t)h, (py::ssize_t)w, (py::ssize_t)chs },
+        { (py::ssize_t)ref->linesize[0], (py::ssize_t)chs, (py::ssize_t)1 },
+        ref->data[0],
+        owner
+    );
     return {true, std::move(ret)};
 }
 
+auto _ReadBatch(vio::VideoReader & reader, int32_t n) -> py::array {
+    py::array ret = _NewOutput(reader, { (py::ssize_t)std::max(n, 0) });
+    if (n <= 0) {
+        return ret;
+    }
+
+    int32_t got = 0;
+    {
+        py::gil_scoped_release release;
+        got = reader.readBatch(static_cast<uint8_t *>(ret.mutable_data()), n);
+    }
+    if (got < n) {
+        // Copy the short tail, a view would keep the whole batch alive.
+        py::array tail = _NewOutput(reader, { (py::ssize_t)got });
+        memcpy(tail.mutable_data(), ret.data(), (size_t)tail.nbytes());
+        return tail;
+    }
+    return ret;
+}
+
+auto _GetFrames(vio::VideoReader & reader, std::vector<int32_t> const & indices) -> std::pair<bool, py::array> {
+    py::array ret = _NewOutput(reader, { (py::ssize_t)indices.size() });
+
+    bool got = false;
+    {
+        py::gil_scoped_release release;
+        got = reader.getFrames(indices, static_cast<uint8_t *>(ret.mutable_data()));
+    }
+    return {got, std::move(ret)};
+}
+
+// Planes of next frame, as (height, width) arrays, or (height, width, channels) for interleaved ones (e.g. uv of nv12).
+auto _ReadPlanes(vio::VideoReader & reader, bool zero_copy) -> std::pair<bool, py::list> {
+    py::list ret;
+    if (!reader.isPlanar()) {
+        spdlog::error("[videoio,pybind] read_planes() is only for planar yuv pix_fmt!");
+        return {false, ret};
+    }
+
+    bool got = false;
+    {
+        py::gil_scoped_release release;
+        got = reader.read();
+    }
+    if (!got) {
+        return {false, ret};
+    }
+
+    // Planes of the decoded frame, if the format is kept, or of the converted one.
+    const AVFrame * frame = reader.frame();
+    AVFrame * ref = nullptr;
+    py::capsule owner;
+    if (zero_copy) {
+        ref = av_frame_clone(frame);
+        if (!ref) {
+            spdlog::error("[videoio,pybind] Failed to reference the frame!");
+            return {false, ret};
+        }
+        owner = py::capsule(ref, [](void * p) {
+            auto * f = static_cast<AVFrame *>(p);
+            av_frame_free(&f);
+        });
+    }
+
+    auto const planes = reader.planes();
+    for (size_t p = 0; p < planes.size(); ++p) {
+        auto const & plane = planes[p];
+        std::vector<py::ssize_t> shape = { plane.height, plane.width };
+        if (plane.channels > 1) shape.push_back(plane.channels);
+        if (zero_copy) {
+            std::vector<py::ssize_t> strides = { ref->linesize[p], plane.channels };
+            if (plane.channels > 1) strides.push_back(1);
+            ret.append(NpFrame(shape, strides, ref->data[p], owner));
+        }
+        else {
+            NpFrame arr(shape);
+            int const row_bytes = plane.width * plane.channels;
+            av_image_copy_plane(arr.mutable_data(), row_bytes, frame->data[p], frame->linesize[p], row_bytes, plane.height);
+            ret.append(std::move(arr));
+        }
+    }
+    return {true, ret};
+}
+
+static std::map<std::string, vio::IOMode> g_str2iomode = {
+    {"stdio", vio::IOMode::Stdio},
+    {"mmap",  vio::IOMode::Mmap},
+    {"readahead", vio::IOMode::ReadAhead},
+    {"pread", vio::IOMode::Pread},
+};
+
+auto _IOModeName(vio::IOMode mode) -> std::string {
+    for (auto const & kv : g_str2iomode) {
+        if (kv.second == mode) return kv.first;
+    }
+    return "";
+}
+
+void _SetIOMode(vio::VideoReader & reader, std::string const & mode) {
+    auto it = g_str2iomode.find(mode);
+    if (it == g_str2iomode.end()) {
+        throw py::value_error("Unknown io_mode '" + mode + "'");
+    }
+    reader.setIOMode(it->second);
+}
+
 bool _OpenReaderWithFile(
     vio::VideoReader & reader,
     std::string filename,
     std::string pix_fmt,
     std::pair<int, int> image_size
 ) {
-    pix_fmt = _CheckInputPixFmt(pix_fmt);
+    pix_fmt = _CheckOutputPixFmt(pix_fmt);
     if (pix_fmt.length() == 0) return false;
+    py::gil_scoped_release release;
     return reader.open(filename, pix_fmt, image_size);
 }
 
+// Any contiguous buffer (bytes, bytearray, memoryview, numpy array), read in place.
+// The reader holds the buffer until closing, so the caller doesn't need to keep it alive.
 bool _OpenReaderWithBytes(
     vio::VideoReader & reader,
-    NpBytes const & bytes,
+    py::buffer bytes,
     std::string pix_fmt,
     std::pair<int, int> image_size
 ) {
-    pix_fmt = _CheckInputPixFmt(pix_fmt);
+    pix_fmt = _CheckOutputPixFmt(pix_fmt);
     if (pix_fmt.length() == 0) return false;
-    return reader.open(bytes.data(), bytes.size(), pix_fmt, image_size);
+
+    // The buffer view is released with the gil, the reader may drop it without.
+    std::shared_ptr<py::buffer_info> info(new py::buffer_info(bytes.request()), [](py::buffer_info * p) {
+        py::gil_scoped_acquire acquire;
+        delete p;
+    });
+    py::ssize_t expect = info->itemsize;
+    for (py::ssize_t i = info->ndim - 1; i >= 0; --i) {
+        if (info->shape[i] > 1 && info->strides[i] != expect) {
+            spdlog::error("[videoio,pybind] Bytes should be a contiguous buffer!");
+            return false;
+        }
+        expect *= info->shape[i];
+    }
+    auto const * data = static_cast<uint8_t const *>(info->ptr);
+    size_t const size = (size_t)info->size * (size_t)info->itemsize;
+
+    py::gil_scoped_release release;
+    return reader.open(data, size, pix_fmt, image_size, std::move(info));
+}
+
+// Workers may need the gil (e.g. reading a python stream), it's released when waiting for them
+// from python (e.g. the reader dropped by gc).
+void _WaitWithoutGil(std::function<void()> const & fn) {
+    if (PyGILState_Check()) {
+        py::gil_scoped_release release;
+        fn();
+    }
+    else {
+        fn();
+    }
+}
+
+// Python callable held without the gil (e.g. by the read-ahead worker), released with the gil.
+auto _HoldCallable(py::object fn) -> std::shared_ptr<py::object> {
+    return std::shared_ptr<py::object>(new py::object(std::move(fn)), [](py::object * p) {
+        py::gil_scoped_acquire acquire;
+        delete p;
+    });
+}
+
+// A stream given by read(n) -> bytes-like (empty or None at the end), and seek(offset, whence) -> position
+// (None for non-seekable streams). They are called from the read-ahead worker with the gil acquired.
+bool _OpenReaderWithStream(
+    vio::VideoReader & reader,
+    py::object read,
+    py::object seek,
+    std::string pix_fmt,
+    std::pair<int, int> image_size,
+    size_t readahead
+) {
+    pix_fmt = _CheckOutputPixFmt(pix_fmt);
+    if (pix_fmt.length() == 0) return false;
+
+    auto read_fn = _HoldCallable(std::move(read));
+    vio::AVStreamIOContext::ReadFn read_stream = [read_fn](uint8_t * buf, int64_t size) -> int64_t {
+        py::gil_scoped_acquire acquire;
+        try {
+            py::object data = (*read_fn)(size);
+            if (data.is_none()) return 0;
+            py::buffer_info info = py::buffer(data).request();
+            int64_t n = std::min(size, (int64_t)(info.size * info.itemsize));
+            memcpy(buf, info.ptr, (size_t)n);
+            return n;
+        }
+        catch (std::exception const & e) {
+            spdlog::error("[videoio,pybind] Failed to read the stream: {}", e.what());
+            return -1;
+        }
+    };
+    vio::AVStreamIOContext::SeekFn seek_stream = nullptr;
+    if (!seek.is_none()) {
+        auto seek_fn = _HoldCallable(std::move(seek));
+        seek_stream = [seek_fn](int64_t offset, int whence) -> int64_t {
+            py::gil_scoped_acquire acquire;
+            try {
+                return (*seek_fn)(offset, whence).cast<int64_t>();
+            }
+            catch (std::exception const & e) {
+                spdlog::error("[videoio,pybind] Failed to seek the stream: {}", e.what());
+                return -1;
+            }
+        };
+    }
+    py::gil_scoped_release release;
+    return reader.open(
+        std::unique_ptr<vio::AVIOBase>(new vio::AVStreamIOContext(read_stream, seek_stream, readahead, &_WaitWithoutGil)),
+        pix_fmt, image_size
+    );
 }
 
 bool _OpenWriter(
@@ -88,6 +399,7 @@ bool _OpenWriter(
     cfg.bitrate = bitrate;
     cfg.crf = crf;
     cfg.g = g;
+    py::gil_scoped_release release;
     return self.open(filename, cfg);
 }
 
@@ -121,6 +433,7 @@ bool _Write(vio::VideoWriter & self, NpImage const & image) {
         height = image.shape(0);
         linesize = image.strides(0);
         // spdlog::warn("linesize: {}, height: {}, width: {}", linesize, height, image.shape(1));
+        py::gil_scoped_release release;
         self.write(data, linesize, height);
         return true;
     }
@@ -159,9 +472,18 @@ PYBIND11_MODULE(videoio, m) {
     av_log_set_level(AV_LOG_ERROR);
 
     m.def("set_log_level", &SetLogLevel);
+    m.def("set_frame_cache_limit", [](size_t bytes) { vio::FramePool::Instance().setLimit(bytes); }, "bytes"_a);
+    m.def("frame_cache_limit", []() { return vio::FramePool::Instance().limit(); });
+    m.def("frame_memory_usage", []() { return vio::FramePool::Instance().used(); });
+    m.def("trim_frame_pool", []() { vio::FramePool::Instance().trim(); });
+    m.attr("LOWRES_AUTO") = vio::kLowresAuto;
 
     py::class_<vio::VideoReader>(m, "VideoReader")
-        .def(py::init<>())
+        .def(py::init([]() {
+            auto * reader = new vio::VideoReader();
+            reader->setWaitFn(&_WaitWithoutGil);
+            return reader;
+        }))
         .def_property_readonly("n_frames", &vio::VideoReader::numFrames)
         .def_property_readonly("duration", [](vio::VideoReader const & r) { auto ts = r.duration(); return vio::cast<vio::MsDouble>(ts).count(); })
         .def_property_readonly("curr_msec", [](vio::VideoReader const & r) { auto ts = r.currMillisecond(); return vio::cast<vio::MsDouble>(ts).count(); })
@@ -173,11 +495,57 @@ PYBIND11_MODULE(videoio, m) {
         .def_property_readonly("fps", [](vio::VideoReader const & r) { auto tbr = r.tbr(); return (double)tbr.num / (double)tbr.den; })
         .def("open", &_OpenReaderWithFile, "filename"_a, "pix_fmt"_a="bgr24", "image_size"_a=std::pair<int, int>(0, 0))
         .def("open_bytes", &_OpenReaderWithBytes, "bytes"_a, "pix_fmt"_a="bgr24", "image_size"_a=std::pair<int, int>(0, 0))
-        .def("seek_frame", &vio::VideoReader::seekByFrame)
-        .def("seek_msec", [](vio::VideoReader & r, float msec) -> bool { return r.seekByTime(vio::Millisecond((int64_t)std::round(msec))); })
-        .def("release", &vio::VideoReader::close)
-        .def("close", &vio::VideoReader::close)
-        .def("read", &_Read, py::return_value_policy::move)
+        .def("open_stream", &_OpenReaderWithStream, "read"_a, "seek"_a=py::none(), "pix_fmt"_a="bgr24", "image_size"_a=std::pair<int, int>(0, 0), "readahead"_a=vio::kDefaultReadAhead)
+        .def("seek_frame", &vio::VideoReader::seekByFrame, py::call_guard<py::gil_scoped_release>())
+        .def("seek_msec", [](vio::VideoReader & r, float msec) -> bool { return r.seekByTime(vio::Millisecond((int64_t)std::round(msec))); }, py::call_guard<py::gil_scoped_release>())
+        .def("release", &vio::VideoReader::close, py::call_guard<py::gil_scoped_release>())
+        .def("close", &vio::VideoReader::close, py::call_guard<py::gil_scoped_release>())
+        .def("read", &_Read, "zero_copy"_a=false, py::return_value_policy::move)
+        .def("read_planes", &_ReadPlanes, "zero_copy"_a=false)
+        .def_property_readonly("planes", [](vio::VideoReader const & r) {
+            std::vector<std::tuple<size_t, int32_t, int32_t, int32_t>> ret;
+            for (auto const & p : r.planes()) ret.emplace_back(p.offset, p.height, p.width, p.channels);
+            return ret;
+        })
+        .def("read_into", &_ReadInto, "out"_a)
+        .def("seek_and_read_into", &_SeekAndReadInto, "frame_idx"_a, "out"_a)
+        .def("read_batch", &_ReadBatch, "n"_a)
+        .def("get_frames", &_GetFrames, "indices"_a)
+        .def_property("indexing", &vio::VideoReader::indexing, &vio::VideoReader::setIndexing)
+        .def_property_readonly("indexed", &vio::VideoReader::isIndexed)
+        .def_property("index_cache", &vio::VideoReader::indexCache, &vio::VideoReader::setIndexCache)
+        .def_property("cache_bytes", &vio::VideoReader::cacheBudget, [](vio::VideoReader & r, size_t n) { py::gil_scoped_release _; r.setCacheBudget(n); })
+        .def_property_readonly("cache_hits", &vio::VideoReader::cacheHits)
+        .def_property_readonly("cache_misses", &vio::VideoReader::cacheMisses)
+        .def_property("prefetch", &vio::VideoReader::prefetchSize, [](vio::VideoReader & r, size_t n) { py::gil_scoped_release _; r.setPrefetch(n); })
+        .def_property_readonly("peak_memory", &vio::VideoReader::peakMemory)
+        .def_property("fast_convert", &vio::VideoReader::fastConvert, &vio::VideoReader::setFastConvert)
+        .def_property("io_mode", [](vio::VideoReader const & r) { return _IOModeName(r.ioMode()); }, &_SetIOMode)
+        .def_property("readahead", &vio::VideoReader::readAhead, &vio::VideoReader::setReadAhead)
+        .def_property_readonly("io_stats", [](vio::VideoReader const & r) {
+            auto stats = r.ioStats();
+            py::dict ret;
+            ret["bytes_read"] = stats.bytes_read;
+            ret["stall_ms"] = stats.stall_ms;
+            return ret;
+        })
+        .def_property("keyframes_only", &vio::VideoReader::keyframesOnly, &vio::VideoReader::setKeyframesOnly)
+        .def_property("lowres", &vio::VideoReader::lowres, &vio::VideoReader::setLowres)
+        .def_property_readonly("roi", [](vio::VideoReader const & r) { auto const & roi = r.roi(); return std::make_tuple(roi.x, roi.y, roi.w, roi.h); })
+        .def("set_roi", [](vio::VideoReader & r, std::tuple<int32_t, int32_t, int32_t, int32_t> roi) -> bool {
+            py::gil_scoped_release _;
+            return r.setRoi({ std::get<0>(roi), std::get<1>(roi), std::get<2>(roi), std::get<3>(roi) });
+        }, "roi"_a)
+        .def_property("stride", &vio::VideoReader::stride, [](vio::VideoReader & r, int n) { py::gil_scoped_release _; r.setStride(n); })
+        .def_property("sample_fps", &vio::VideoReader::sampleFps, [](vio::VideoReader & r, double fps) { py::gil_scoped_release _; r.setSampleFps(fps); })
+        .def("set_output", [](vio::VideoReader & r, std::string layout, std::string dtype, std::vector<float> mean, std::vector<float> std) -> bool {
+            vio::TensorSpec spec;
+            if (!vio::TensorSpec::Parse(layout, dtype, spec)) return false;
+            spec.mean = std::move(mean);
+            spec.std  = std::move(std);
+            return r.setOutput(spec);
+        }, "layout"_a="hwc", "dtype"_a="uint8", "mean"_a=std::vector<float>(), "std"_a=std::vector<float>(), py::call_guard<py::gil_scoped_release>())
+        .def_property("convert_threads", &vio::VideoReader::convertThreads, [](vio::VideoReader & r, int n) { py::gil_scoped_release _; r.setConvertThreads(n); })
         // static
         .def_static("set_log_level", &SetLogLevel)
     ;
@@ -185,8 +553,8 @@ PYBIND11_MODULE(videoio, m) {
     py::class_<vio::VideoWriter>(m, "VideoWriter")
         .def(py::init<>())
         .def("open", &_OpenWriter, "filename"_a, "image_size"_a, "fps"_a, "pix_fmt"_a="bgr24", "bitrate"_a=0, "crf"_a=23.0, "g"_a=12)
-        .def("release", &vio::VideoWriter::close)
-        .def("close", &vio::VideoWriter::close)
+        .def("release", &vio::VideoWriter::close, py::call_guard<py::gil_scoped_release>())
+        .def("close", &vio::VideoWriter::close, py::call_guard<py::gil_scoped_release>())
         .def("write", &_Write)
         // static
         .def_static("set_log_level", &SetLogLevel)
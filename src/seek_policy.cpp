@@ -0,0 +1,89 @@
+#include <algorithm>
+#include "seek_policy.hpp"
+
+namespace vio {
+
+// Weights of a new sample in the moving averages.
+static const double kDecodeCostAlpha = 0.05;
+static const double kSeekCostAlpha   = 0.2;
+// Seeking is assumed to cost as much as decoding this number of frames, before it's measured.
+static const double kDefaultSeekFrames = 10.0;
+
+void SeekPolicy::reset() {
+    decode_ms_  = 0;
+    seek_ms_    = 0;
+    seek_count_ = 0;
+    keyframes_.clear();
+    last_key_   = -1;
+    gop_        = 0;
+}
+
+void SeekPolicy::addFrame(int32_t frame_idx, bool is_key) {
+    if (frame_idx < 0) {
+        return;
+    }
+    if (is_key) {
+        keyframes_.insert(frame_idx);
+        if (last_key_ >= 0 && frame_idx > last_key_) {
+            gop_ = std::max(gop_, frame_idx - last_key_);
+        }
+        last_key_ = frame_idx;
+    }
+    else if (last_key_ >= 0 && frame_idx > last_key_) {
+        // The GOP is at least this long.
+        gop_ = std::max(gop_, frame_idx - last_key_ + 1);
+    }
+}
+
+void SeekPolicy::addDecodeCost(double ms) {
+    decode_ms_ = (decode_ms_ > 0) ? decode_ms_ + kDecodeCostAlpha * (ms - decode_ms_) : ms;
+}
+
+void SeekPolicy::addSeekCost(double ms) {
+    ms = std::max(ms, 0.0);
+    seek_ms_ = (seek_count_ > 0) ? seek_ms_ + kSeekCostAlpha * (ms - seek_ms_) : ms;
+    seek_count_++;
+}
+
+int32_t SeekPolicy::_keyFrameBefore(int32_t frame_idx) const {
+    auto it = keyframes_.upper_bound(frame_idx);
+    if (it == keyframes_.begin()) {
+        // Nothing known, optimistically assume a key frame right there.
+        return (gop_ > 0) ? std::max(frame_idx - gop_ + 1, 0) : frame_idx;
+    }
+    int32_t key = *std::prev(it);
+    // Beyond the known ones, assume regular GOPs of the longest size seen.
+    if (gop_ > 0 && frame_idx - key >= gop_) {
+        key += (frame_idx - key) / gop_ * gop_;
+    }
+    return key;
+}
+
+bool SeekPolicy::shouldSeek(int32_t last_idx, int32_t frame_idx, FrameIndex const & index) const {
+    // Behind, or at an unknown position (e.g. after a frame without pts), -1 is before the first frame.
+    if (last_idx >= frame_idx || last_idx < -1) {
+        return true;
+    }
+
+    // Number of frames to decode, by either way.
+    int32_t n_forward = 0;
+    int32_t n_seek = 0;
+    if (!index.empty()) {
+        auto target = index.decodeOrder(frame_idx);
+        n_forward = target - ((last_idx >= 0) ? index.decodeOrder(last_idx) : -1);
+        n_seek    = target - index.seekPacket(frame_idx) + 1;
+    }
+    else {
+        n_forward = frame_idx - last_idx;
+        n_seek    = frame_idx - this->_keyFrameBefore(frame_idx) + 1;
+    }
+    if (n_seek >= n_forward) {
+        return false;
+    }
+
+    double decode_ms = (decode_ms_ > 0) ? decode_ms_ : 1.0;
+    double seek_ms   = (seek_count_ > 0) ? seek_ms_ : decode_ms * kDefaultSeekFrames;
+    return seek_ms + n_seek * decode_ms < n_forward * decode_ms;
+}
+
+}
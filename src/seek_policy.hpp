@@ -0,0 +1,44 @@
+#pragma once
+#include <set>
+
+#include "common.hpp"
+#include "frame_index.hpp"
+
+namespace vio {
+
+/**
+ * Decide between seeking and decoding forward to reach a frame, whichever is expected to be faster.
+ * - Key frames are known from the packet index, or learned from decoded frames (with the GOP size).
+ * - Costs of decoding a frame and of seeking (flush, seek and refill the decoder) are measured, as moving averages.
+ * */
+class SeekPolicy {
+public:
+    SeekPolicy() { this->reset(); }
+
+    void reset();
+
+    // Observations
+    void addFrame(int32_t frame_idx, bool is_key);  // a decoded frame
+    void addDecodeCost(double ms);
+    void addSeekCost(double ms);
+    void onSeek() { last_key_ = -1; }
+
+    auto decodeCost() const -> double { return decode_ms_; }
+    auto seekCost()   const -> double { return seek_ms_; }
+
+    // Should the decoder seek, with its last output frame 'last_idx' (-1 if none) and the target frame.
+    bool shouldSeek(int32_t last_idx, int32_t frame_idx, FrameIndex const & index) const;
+
+private:
+    double decode_ms_;  // per decoded frame, 0 before measured
+    double seek_ms_;    // per seek, excluding the decoding of the target frame, 0 before measured
+    int32_t seek_count_;
+    // Learned key frames (without index).
+    std::set<int32_t> keyframes_;
+    int32_t last_key_;  // the key frame that the current decoding run starts from, -1 if unknown
+    int32_t gop_;       // longest distance between key frames seen, 0 if unknown
+
+    auto _keyFrameBefore(int32_t frame_idx) const -> int32_t;
+};
+
+}
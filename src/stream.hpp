@@ -1,5 +1,8 @@
 #pragma once
+#include <atomic>
+#include <list>
 #include <vector>
+#include <unordered_map>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -9,6 +12,8 @@ extern "C" {
 }
 
 #include "common.hpp"
+#include "frame_pool.hpp"
+#include "converter.hpp"
 
 namespace vio {
 
@@ -80,122 +85,130 @@ public:
 };
 
 
-class CircleBuffer {
-    size_t head_;
-    size_t tail_;
-    size_t size_;
-    std::vector<AVFrame *> buffer_;
-    bool allocated_;
-
-    void _inc(size_t & _idx) {
-        _idx = (_idx + 1) % buffer_.size();
-    }
-
-    void _cleanup() {
-        for (auto * & p : buffer_) {
-            if (p) {
-                av_frame_free(&p);
-                p = nullptr;
-            }
+/**
+ * LRU cache of decoded frames, keyed by frame index and bounded by a byte budget.
+ * Entries reference the (refcounted) buffers of decoded frames, nothing is copied.
+ * Cached bytes are also accounted in the per-process limit of FramePool.
+ * */
+class FrameCache {
+    struct Entry {
+        int32_t   key;
+        AVFrame * frame;
+        size_t    bytes;
+    };
+
+    // Counters are atomic, read by other threads while the decoding one (e.g. the prefetch worker) updates.
+    size_t budget_;
+    std::atomic<size_t> bytes_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::list<Entry> lru_;  // front is the most recently used
+    std::unordered_map<int32_t, std::list<Entry>::iterator> map_;
+
+    void _erase(std::list<Entry>::iterator it) {
+        bytes_ -= it->bytes;
+        FramePool::Instance().release(it->bytes);
+        av_frame_free(&it->frame);
+        map_.erase(it->key);
+        lru_.erase(it);
+    }
+
+    void _evict() {
+        while (bytes_ > budget_ && !lru_.empty()) {
+            this->_erase(std::prev(lru_.end()));
         }
-        buffer_.clear();
-        allocated_ = false;
-        head_ = tail_ = 0;
     }
 
 public:
-    CircleBuffer()
-        : head_(0), tail_(0)  // [head_, tail_)
-        , size_(0), buffer_()
-        , allocated_(false)
-        // ! one extra item for judging full queue.
-        // ! so that, full is (tail_ + 1 == head_), empty is (tail_ == head_)
+    FrameCache(size_t budget = 0)
+        : budget_(budget), bytes_(0)
+        , hits_(0), misses_(0)
+        , lru_(), map_()
     {}
-    ~CircleBuffer() {
-        this->_cleanup();
+    ~FrameCache() {
+        this->clear();
     }
 
     void clear() {
-        this->_cleanup();
-    }
-
-    void allocate(size_t size, enum AVPixelFormat pixFmt, int width, int height) {
-        this->_cleanup();
-        buffer_.resize(size + 1, nullptr);
-        size_ = size;
-        for (size_t i = 0; i < buffer_.size(); ++i) {
-            buffer_[i] = AllocateFrame(pixFmt, width, height);
+        while (!lru_.empty()) {
+            this->_erase(lru_.begin());
         }
-        allocated_ = true;
     }
 
-    size_t size() const {
-        return size_;
-    }
+    void set_budget(size_t budget) { budget_ = budget; this->_evict(); }
+    auto budget() const -> size_t { return budget_; }
+    auto bytes()  const -> size_t { return bytes_; }
+    auto size()   const -> size_t { return map_.size(); }
+    auto hits()   const -> uint64_t { return hits_; }
+    auto misses() const -> uint64_t { return misses_; }
 
-    size_t n_elements() const {
-        if (tail_ >= head_) {
-            return tail_ - head_;
-        } else {
-            return tail_ + buffer_.size() - head_;
+    // Reference the frame with key, the old one of same key is replaced.
+    void put(int32_t key, const AVFrame * frame) {
+        auto found = map_.find(key);
+        if (found != map_.end()) {
+            this->_erase(found->second);
         }
-    }
-
-    bool is_empty() const {
-        return tail_ == head_;
-    }
-
-    bool is_full() const {
-        return (tail_ + 1 == head_) || (head_ == 0 && tail_ == size_);
-    }
-
-    void push_back() {
-        this->_inc(tail_);
-        if (tail_ == head_) {
-            this->_inc(head_);
+        size_t bytes = FrameBytes(frame);
+        if (bytes > budget_) {
+            return;
         }
-    }
-
-    void pop_front() {
-        // ! must check not empty before pop;
-        if (!this->is_empty()) {
-            this->_inc(head_);
+        while (bytes_ + bytes > budget_ && !lru_.empty()) {
+            this->_erase(std::prev(lru_.end()));
         }
+        // Make room in the per-process limit. Refuse if the memory is held by others.
+        while (!FramePool::Instance().reserve(bytes)) {
+            if (lru_.empty()) return;
+            this->_erase(std::prev(lru_.end()));
+        }
+        AVFrame * ref = av_frame_clone(frame);
+        if (!ref) {
+            FramePool::Instance().release(bytes);
+            return;
+        }
+        lru_.push_front({ key, ref, bytes });
+        map_[key] = lru_.begin();
+        bytes_ += bytes;
     }
 
-    AVFrame * offset_front(size_t _off) {
-        assert(allocated_);
-        return buffer_[(head_ + _off) % buffer_.size()];
-    }
-
-    AVFrame * offset_back(size_t _off) {
-        assert(allocated_);
-        _off += 1; // since 'tail_-1' point to last element
-        size_t t = tail_;
-        if (t < _off) {
-            t += buffer_.size();
+    // Get the frame of key and mark it as most recently used. nullptr if missing.
+    auto get(int32_t key) -> const AVFrame * {
+        auto found = map_.find(key);
+        if (found == map_.end()) {
+            misses_++;
+            return nullptr;
         }
-        return buffer_[t - _off];
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, found->second);
+        return found->second->frame;
     }
 };
 
 class InputStreamData : public StreamData {
 public:
-    InputStreamData(): buffer_(), pkt_({}) {}
-    auto buffer() const -> CircleBuffer const & { return buffer_; }
-    auto buffer()       -> CircleBuffer       & { return buffer_; }
-    auto packet()       -> AVPacket           & { return pkt_; }
+    InputStreamData()
+        : cache_(), converter_(), pkt_({})
+        , decoded_(av_frame_alloc(), [](AVFrame *x) { if (x) { av_frame_free(&x); } })
+    {}
+    auto cache() const -> FrameCache const & { return cache_; }
+    auto cache()       -> FrameCache       & { return cache_; }
+    auto packet()      -> AVPacket         & { return pkt_; }
+    auto converter()   -> FrameConverter   & { return converter_; }
+    auto decoded()     -> AVFrame          * { return decoded_.get(); }  // the last decoded (or cached) frame
     auto image_size() const -> std::pair<int, int> const & { return image_size_; }
     auto image_size()       -> std::pair<int, int>       & { return image_size_; }
 
     void reset() override {
         StreamData::reset();
-        buffer_.clear();
+        cache_.clear();
+        converter_.reset();
+        decoded_.reset();
     }
 
 private:
-    CircleBuffer buffer_;
+    FrameCache cache_;
+    FrameConverter converter_;
     AVPacket pkt_;
+    std::unique_ptr<AVFrame, void(*)(AVFrame *)> decoded_;
     std::pair<int, int> image_size_;
 };
 
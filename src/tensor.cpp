@@ -0,0 +1,180 @@
+#include <cstring>
+#include "log.hpp"
+#include "tensor.hpp"
+
+namespace vio {
+
+// IEEE 754 half precision, rounded to nearest even.
+static uint16_t _FloatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int32_t  fexp = (int32_t)((x >> 23) & 0xff);
+    int32_t  exp  = fexp - 127 + 15;
+
+    if (fexp == 0xff) {  // inf, nan
+        return (uint16_t)(sign | 0x7c00 | ((mant) ? 0x200 : 0));
+    }
+    if (exp >= 31) {  // overflow
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (exp <= 0) {  // subnormal
+        if (exp < -10) {
+            return (uint16_t)sign;
+        }
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rem  = mant & ((1u << shift) - 1);
+        uint32_t mid  = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem  = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;  // may carry into the exponent, that's right
+    return (uint16_t)half;
+}
+
+bool TensorSpec::Parse(std::string const & layout, std::string const & dtype, TensorSpec & spec) {
+    if      (layout == "hwc") { spec.layout = TensorLayout::HWC; }
+    else if (layout == "chw") { spec.layout = TensorLayout::CHW; }
+    else {
+        spdlog::error("[vio::TensorSpec]: Unknown layout '{}', can be: hwc | chw.", layout);
+        return false;
+    }
+    if      (dtype == "uint8")   { spec.dtype = TensorDType::UInt8;   }
+    else if (dtype == "float32") { spec.dtype = TensorDType::Float32; }
+    else if (dtype == "float16") { spec.dtype = TensorDType::Float16; }
+    else {
+        spdlog::error("[vio::TensorSpec]: Unknown dtype '{}', can be: uint8 | float32 | float16.", dtype);
+        return false;
+    }
+    return true;
+}
+
+bool TensorSpec::check(int channels) const {
+    if (mean.empty() != std.empty()) {
+        spdlog::error("[vio::TensorSpec]: mean and std should be given together.");
+        return false;
+    }
+    if (!mean.empty()) {
+        if (dtype == TensorDType::UInt8) {
+            spdlog::error("[vio::TensorSpec]: mean and std are only for float outputs.");
+            return false;
+        }
+        if ((int)mean.size() != channels || (int)std.size() != channels) {
+            spdlog::error("[vio::TensorSpec]: mean and std should have {} values, one per channel.", channels);
+            return false;
+        }
+        for (auto s : std) {
+            if (s == 0.0f) {
+                spdlog::error("[vio::TensorSpec]: std should not be zero.");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TensorWriter::init(TensorSpec const & spec, int channels) {
+    if (!spec.check(channels)) {
+        return false;
+    }
+    spec_ = spec;
+    channels_ = channels;
+
+    // v = x * scale + bias, i.e. (x / 255 - mean) / std.
+    scale_.assign(channels, 1.0f / 255.0f);
+    bias_.assign(channels, 0.0f);
+    for (int c = 0; c < channels && !spec.mean.empty(); ++c) {
+        scale_[c] = 1.0f / (255.0f * spec.std[c]);
+        bias_[c]  = -spec.mean[c] / spec.std[c];
+    }
+    half_lut_.clear();
+    if (spec.dtype == TensorDType::Float16) {
+        half_lut_.resize((size_t)channels * 256);
+        for (int c = 0; c < channels; ++c) {
+            for (int x = 0; x < 256; ++x) {
+                half_lut_[c * 256 + x] = _FloatToHalf((float)x * scale_[c] + bias_[c]);
+            }
+        }
+    }
+    return true;
+}
+
+// kChs is the number of channels known at compile time (so that loops are unrolled and vectorized), 0 if not.
+template <int kChs, typename T, typename Fn>
+static void _WriteTensor(
+    uint8_t const * src, int linesize, int width, int height, int channels,
+    TensorLayout layout, T * dst, Fn const & fn
+) {
+    int const chs = (kChs > 0) ? kChs : channels;
+    if (layout == TensorLayout::HWC) {
+        for (int y = 0; y < height; ++y) {
+            uint8_t const * s = src + (ptrdiff_t)y * linesize;
+            T * d = dst + (ptrdiff_t)y * width * chs;
+            for (int x = 0; x < width; ++x) {
+                for (int c = 0; c < chs; ++c) {
+                    d[x * chs + c] = fn(s[x * chs + c], c);
+                }
+            }
+        }
+        return;
+    }
+
+    // CHW, deinterleave each row into the planes.
+    size_t const plane = (size_t)width * height;
+    for (int y = 0; y < height; ++y) {
+        uint8_t const * s = src + (ptrdiff_t)y * linesize;
+        for (int c = 0; c < chs; ++c) {
+            T * d = dst + plane * c + (size_t)y * width;
+            for (int x = 0; x < width; ++x) {
+                d[x] = fn(s[x * chs + c], c);
+            }
+        }
+    }
+}
+
+template <typename T, typename Fn>
+void TensorWriter::_write(uint8_t const * src, int linesize, int width, int height, T * dst, Fn const & fn) const {
+    switch (channels_) {
+    case 1:  _WriteTensor<1>(src, linesize, width, height, channels_, spec_.layout, dst, fn); break;
+    case 3:  _WriteTensor<3>(src, linesize, width, height, channels_, spec_.layout, dst, fn); break;
+    case 4:  _WriteTensor<4>(src, linesize, width, height, channels_, spec_.layout, dst, fn); break;
+    default: _WriteTensor<0>(src, linesize, width, height, channels_, spec_.layout, dst, fn); break;
+    }
+}
+
+void TensorWriter::write(uint8_t const * src, int linesize, int width, int height, void * dst) const {
+    switch (spec_.dtype) {
+    case TensorDType::UInt8:
+        if (spec_.layout == TensorLayout::HWC) {
+            for (int y = 0; y < height; ++y) {
+                memcpy(static_cast<uint8_t *>(dst) + (size_t)y * width * channels_, src + (ptrdiff_t)y * linesize, (size_t)width * channels_);
+            }
+        }
+        else {
+            this->_write(src, linesize, width, height, static_cast<uint8_t *>(dst), [](uint8_t x, int) { return x; });
+        }
+        break;
+    case TensorDType::Float32: {
+        float const * scale = scale_.data();
+        float const * bias  = bias_.data();
+        this->_write(src, linesize, width, height, static_cast<float *>(dst), [scale, bias](uint8_t x, int c) {
+            return (float)x * scale[c] + bias[c];
+        });
+        break;
+    }
+    case TensorDType::Float16: {
+        uint16_t const * lut = half_lut_.data();
+        this->_write(src, linesize, width, height, static_cast<uint16_t *>(dst), [lut](uint8_t x, int c) {
+            return lut[c * 256 + x];
+        });
+        break;
+    }
+    }
+}
+
+}
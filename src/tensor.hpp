@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace vio {
+
+enum class TensorLayout { HWC, CHW };
+enum class TensorDType { UInt8, Float32, Float16 };
+
+/**
+ * Layout and type of the output frames.
+ * Float outputs are x / 255, then normalized by (v - mean) / std per channel if mean and std are given.
+ * The default (HWC, uint8) is the packed image itself.
+ * */
+struct TensorSpec {
+    TensorLayout layout = TensorLayout::HWC;
+    TensorDType  dtype  = TensorDType::UInt8;
+    std::vector<float> mean;  // empty, or one value per channel
+    std::vector<float> std;
+
+    bool isImage() const { return layout == TensorLayout::HWC && dtype == TensorDType::UInt8; }
+    auto elementBytes() const -> int { return (dtype == TensorDType::UInt8) ? 1 : (dtype == TensorDType::Float16) ? 2 : 4; }
+
+    // Parse from names ("hwc" / "chw", "uint8" / "float32" / "float16"). False if invalid.
+    static bool Parse(std::string const & layout, std::string const & dtype, TensorSpec & spec);
+    // Check with the number of channels of image.
+    bool check(int channels) const;
+};
+
+/**
+ * Writes packed images into tensors of a spec, in one pass.
+ * Float32 values are computed with per-channel scale and bias, float16 ones are looked up from tables.
+ * */
+class TensorWriter {
+public:
+    TensorWriter() : channels_(0) {}
+
+    bool init(TensorSpec const & spec, int channels);
+    auto spec() const -> TensorSpec const & { return spec_; }
+
+    // Write the image of (height, width, channels) with linesize into dst, which is contiguous.
+    void write(uint8_t const * src, int linesize, int width, int height, void * dst) const;
+
+private:
+    TensorSpec spec_;
+    int channels_;
+    std::vector<float>    scale_;   // per channel
+    std::vector<float>    bias_;
+    std::vector<uint16_t> half_lut_;  // [channel][256]
+
+    template <typename T, typename Fn>
+    void _write(uint8_t const * src, int linesize, int width, int height, T * dst, Fn const & fn) const;
+};
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace vio {
+
+/**
+ * A small fixed pool of worker threads, to run the tasks of one job in parallel.
+ * The calling thread works on the job too, and waits until all tasks are done.
+ * */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t n_workers)
+        : stop_(false), job_(0), fn_(nullptr)
+        , n_tasks_(0), next_(0), pending_(0)
+    {
+        for (size_t i = 0; i < n_workers; ++i) {
+            workers_.emplace_back(&ThreadPool::_loop, this);
+        }
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto & w : workers_) {
+            w.join();
+        }
+    }
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator=(ThreadPool const &) = delete;
+
+    auto size() const -> size_t { return workers_.size(); }
+
+    // Run fn(0), ..., fn(n - 1) and return when all are done. Jobs from several threads are run one by one.
+    void run(int n, std::function<void(int)> const & fn) {
+        std::lock_guard<std::mutex> run_lock(run_mutex_);
+        uint64_t job = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job      = ++job_;
+            fn_      = &fn;
+            n_tasks_ = n;
+            next_    = 0;
+            pending_ = n;
+        }
+        cv_.notify_all();
+        this->_work(job);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return pending_ == 0; });
+        fn_ = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    bool stop_;
+    // The current job, tasks are claimed with the lock.
+    uint64_t job_;
+    std::function<void(int)> const * fn_;
+    int n_tasks_;
+    int next_;
+    int pending_;
+
+    void _work(uint64_t job) {
+        while (true) {
+            int i = 0;
+            std::function<void(int)> const * fn = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (job_ != job || next_ >= n_tasks_) {
+                    return;
+                }
+                i = next_++;
+                fn = fn_;
+            }
+            (*fn)(i);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) {
+                    done_cv_.notify_all();
+                }
+            }
+        }
+    }
+
+    void _loop() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this, seen]() { return stop_ || job_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = job_;
+            }
+            this->_work(seen);
+        }
+    }
+};
+
+}
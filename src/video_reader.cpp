@@ -1,15 +1,43 @@
 extern "C" {
 #include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
 }
+#include <sys/stat.h>
 #include "log.hpp"
 #include "video_reader.hpp"
 
 static int32_t AV_NOIDX_VALUE = (int32_t)UINT32_C(0x80000000);
-static size_t  MAX_FRAME_BUFFER_SIZE = 20;
-static int32_t SEEKING_TRIGGER_HOP = 10;
+// Reads after a seek that make a sequential run, e.g. seek-then-read of a few frames is still random access.
+static const int32_t kSequentialRun = 32;
 
 namespace vio {
 
+// The decoded format if it's 8-bit planar yuv, or yuv420p.
+static AVPixelFormat _nativeYuv(AVPixelFormat fmt) {
+    auto const * desc = av_pix_fmt_desc_get(fmt);
+    if (!desc || av_pix_fmt_count_planes(fmt) < 2 || desc->nb_components < 3 ||
+        (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM))) {
+        return AV_PIX_FMT_YUV420P;
+    }
+    for (int c = 0; c < desc->nb_components; ++c) {
+        if (desc->comp[c].depth != 8) {
+            return AV_PIX_FMT_YUV420P;
+        }
+    }
+    return fmt;
+}
+
+// The first plane is 8-bit luma, as gray8.
+static bool _hasLumaPlane(AVPixelFormat fmt) {
+    auto const * desc = av_pix_fmt_desc_get(fmt);
+    if (!desc || desc->nb_components < 1 ||
+        (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM))) {
+        return false;
+    }
+    auto const & luma = desc->comp[0];
+    return luma.plane == 0 && luma.step == 1 && luma.offset == 0 && luma.shift == 0 && luma.depth == 8;
+}
+
 // * -------------------------------------------------------------------------------------------------------------- * //
 // *                                                  Open / Close                                                  * //
 // * -------------------------------------------------------------------------------------------------------------- * //
@@ -23,7 +51,23 @@ bool VideoReader::open(std::string const & filename, std::string target_pix_fmt,
 
     // 1. Create a file IO.
     // TODO: handle file io error?
-    this->ioctx_ = std::unique_ptr<AVIOBase>(new AVFileIOContext(filename));
+    this->filename_ = filename;
+#ifndef _WIN32
+    if (io_mode_ == IOMode::Mmap) {
+        this->ioctx_ = AVMmapIOContext::Open(filename);
+    }
+    else if (io_mode_ == IOMode::Pread) {
+        this->ioctx_ = AVPreadIOContext::Open(filename);
+    }
+#endif
+    if (io_mode_ == IOMode::ReadAhead) {
+        this->ioctx_ = AVStreamIOContext::OpenFile(filename, readahead_);
+    }
+    if (!this->ioctx_) {
+        this->ioctx_ = std::unique_ptr<AVIOBase>(new AVFileIOContext(filename));
+    }
+    // Probing and indexing scan from the beginning.
+    this->_adviseSequential();
 
     if (!this->_open(target_pix_fmt, target_resolution)) {
         this->_cleanup();
@@ -32,11 +76,15 @@ bool VideoReader::open(std::string const & filename, std::string target_pix_fmt,
     return true;
 }
 
-bool VideoReader::open(const uint8_t * data, size_t size, std::string target_pix_fmt, std::pair<int32_t, int32_t> const & target_resolution) {
+bool VideoReader::open(
+    const uint8_t * data, size_t size, std::string target_pix_fmt, std::pair<int32_t, int32_t> const & target_resolution,
+    std::shared_ptr<void const> owner
+) {
     this->close();  // make sure everything is cleaned up.
 
     // 1. Create a file IO.
     // TODO: handle file io error?
+    this->input_owner_ = std::move(owner);
     this->ioctx_ = std::unique_ptr<AVIOBase>(new AVMemoryIOContext(data, size));
 
     if (!this->_open(target_pix_fmt, target_resolution)) {
@@ -46,10 +94,26 @@ bool VideoReader::open(const uint8_t * data, size_t size, std::string target_pix
     return true;
 }
 
+bool VideoReader::open(std::unique_ptr<AVIOBase> ioctx, std::string target_pix_fmt, std::pair<int32_t, int32_t> const & target_resolution) {
+    this->close();  // make sure everything is cleaned up.
+
+    this->ioctx_ = std::move(ioctx);
+    if (!this->ioctx_) {
+        spdlog::error("[vio::VideoReader]: No input.");
+        return false;
+    }
+
+    if (!this->_open(target_pix_fmt, target_resolution)) {
+        this->_cleanup();
+        return false;
+    }
+    return true;
+}
+
 bool VideoReader::_open(std::string target_pix_fmt, std::pair<int32_t, int32_t> const & target_resolution) {
-    // Target pix_fmt
+    // Target pix_fmt, the native yuv format is known after opening the decoder.
     AVPixelFormat tar_pix_fmt = av_get_pix_fmt(target_pix_fmt.c_str());
-    if (tar_pix_fmt == AV_PIX_FMT_NONE) {
+    if (tar_pix_fmt == AV_PIX_FMT_NONE && target_pix_fmt != kNativeYuv) {
         spdlog::error("[vio::VideoReader]: target pix_fmt '{}' is invalid!", target_pix_fmt);
         return false;
     }
@@ -87,11 +151,21 @@ bool VideoReader::_open(std::string target_pix_fmt, std::pair<int32_t, int32_t>
     if (!this->_findMainStream(tar_pix_fmt, target_resolution)) {
         return false;
     }
+    if (this->isOpened() && !this->_initOutput()) {
+        return false;
+    }
 
     // Seeking information
     seek_to_pts_ = (fmtctx_->iformat->flags & AVFMT_SEEK_TO_PTS) != 0;
     dts_pts_delta_ = 0;
 
+    if (indexing_ && !this->ioctx_->seekable()) {
+        spdlog::warn("[vio::VideoReader]: The input is not seekable, it's not indexed.");
+    }
+    else if (indexing_ && !this->_buildIndex()) {
+        return false;
+    }
+
 #ifndef NDEBUG
     spdlog::debug(
         "start_time: {}, duration: {}, fps {}, tbr {}, {} frames. SEEK_TO_PTS={}",
@@ -153,6 +227,24 @@ bool VideoReader::_findMainStream(AVPixelFormat tar_pix_fmt, std::pair<int32_t,
 #endif
             }
 
+            // Thumbnail decoding: decode at lower resolution.
+            if (lowres_ != 0 && codec->max_lowres > 0) {
+                int n = lowres_;
+                if (n == kLowresAuto) {
+                    n = 0;
+                    auto const & tar = target_resolution;
+                    while (n < codec->max_lowres && tar.first > 0 && tar.second > 0 &&
+                           AV_CEIL_RSHIFT(codec_ctx->width,  n + 1) >= tar.first &&
+                           AV_CEIL_RSHIFT(codec_ctx->height, n + 1) >= tar.second) {
+                        ++n;
+                    }
+                }
+                codec_ctx->lowres = std::min(std::max(n, 0), (int)codec->max_lowres);
+#ifndef NDEBUG
+                spdlog::debug("codec ctx lowres: {}", codec_ctx->lowres);
+#endif
+            }
+
             // Open decoder
             ret = avcodec_open2(codec_ctx, codec, NULL);
             if (ret < 0) {
@@ -160,34 +252,26 @@ bool VideoReader::_findMainStream(AVPixelFormat tar_pix_fmt, std::pair<int32_t,
                 return false;
             }
 
-            // pix fmt
-            AVPixelFormat dec_pix_fmt = codec_ctx->pix_fmt;
-            int target_width  = (target_resolution.first  == 0) ? codec_ctx->width  : target_resolution.first;
-            int target_height = (target_resolution.second == 0) ? codec_ctx->height : target_resolution.second;
-
-            // allocate frame buffer for decoded frames
-            sd->buffer().allocate(MAX_FRAME_BUFFER_SIZE, dec_pix_fmt, codec_ctx->width, codec_ctx->height);
-            // allocate temporary frame (for sws_scale)
-            sd->set_tmp_frame(AllocateFrame(tar_pix_fmt, target_width, target_height));
-            sd->image_size().first = target_width;
-            sd->image_size().second = target_height;
+            // cache of decoded frames, by default sized to frames of the stream (e.g. 4k frames are 4x of 1080p).
+            size_t cache_budget = cache_budget_;
+            if (cache_budget == kCacheBudgetAuto) {
+                int frame_bytes = av_image_get_buffer_size(codec_ctx->pix_fmt, codec_ctx->width, codec_ctx->height, 32);
+                cache_budget = std::max(kDefaultCacheBudget, kDefaultCacheFrames * (size_t)std::max(frame_bytes, 0));
+            }
+            sd->cache().set_budget(cache_budget);
+            // temporary frame (for sws_scale), its buffers are got from the frame pool at the first conversion.
+            AVFrame * tmp_frame = av_frame_alloc();
+            if (!tmp_frame) {
+                spdlog::error("[vio::VideoReader]: Failed to allocate frame");
+                return false;
+            }
+            tmp_frame->format = (tar_pix_fmt == AV_PIX_FMT_NONE) ? _nativeYuv(codec_ctx->pix_fmt) : tar_pix_fmt;
+            sd->set_tmp_frame(tmp_frame);
 
             // allocate scaler
-            if ((dec_pix_fmt != tar_pix_fmt) ||
-                (target_width != codec_ctx->width) ||
-                (target_height != codec_ctx->height)) {
-                // char buf[2048];
-                // av_get_pix_fmt_string(buf, 2048, decPixFmt);
-                // snow::log::info("context: {}", buf);
-                sd->set_sws_ctx(sws_getContext(
-                    codec_ctx->width, codec_ctx->height, dec_pix_fmt,
-                    target_width, target_height, tar_pix_fmt,
-                    SWS_BICUBIC, NULL, NULL, NULL
-                ));
-                if (!sd->sws_ctx()) {
-                    spdlog::error("[vio::VideoReader]: Could not initialize the sws context");
-                    return false;
-                }
+            target_size_ = target_resolution;
+            if (!this->_initConverter(*sd)) {
+                return false;
             }
 
             // stream assignment
@@ -195,6 +279,7 @@ bool VideoReader::_findMainStream(AVPixelFormat tar_pix_fmt, std::pair<int32_t,
             main_stream_data_ = std::move(sd);
             fps_ = stream->avg_frame_rate;
             tbr_ = stream->r_frame_rate;
+            this->_setDiscard();
             if (stream->start_time != AV_NOPTS_VALUE) { start_time_ = AVTime2MS(stream->start_time, stream->time_base); }
             if (stream->duration   != AV_NOPTS_VALUE) { duration_   = AVTime2MS(stream->duration,   stream->time_base); }
             break;
@@ -217,6 +302,125 @@ bool VideoReader::_findMainStream(AVPixelFormat tar_pix_fmt, std::pair<int32_t,
     return true;
 }
 
+bool VideoReader::_initConverter(InputStreamData & sd) {
+    auto * codec_ctx = sd.codec_ctx();
+    auto * tmp_frame = sd.tmp_frame();
+    AVPixelFormat dec_pix_fmt = codec_ctx->pix_fmt;
+    AVPixelFormat tar_pix_fmt = (AVPixelFormat)tmp_frame->format;
+
+    // Region of interest, clamped into the image. The top-left is aligned to the chroma subsampling.
+    Rect roi = { 0, 0, codec_ctx->width, codec_ctx->height };
+    if (!roi_.empty()) {
+        auto const * desc = av_pix_fmt_desc_get(dec_pix_fmt);
+        int align_x = (desc) ? (1 << desc->log2_chroma_w) : 1;
+        int align_y = (desc) ? (1 << desc->log2_chroma_h) : 1;
+        roi.x = std::min(std::max(roi_.x, 0), codec_ctx->width ) / align_x * align_x;
+        roi.y = std::min(std::max(roi_.y, 0), codec_ctx->height) / align_y * align_y;
+        roi.w = std::min(roi_.x + roi_.w, codec_ctx->width ) - roi.x;
+        roi.h = std::min(roi_.y + roi_.h, codec_ctx->height) - roi.y;
+        if (roi.w <= 0 || roi.h <= 0) {
+            spdlog::error(
+                "[vio::VideoReader]: ROI ({}, {}, {}, {}) is out of the image ({}x{}).",
+                roi_.x, roi_.y, roi_.w, roi_.h, codec_ctx->width, codec_ctx->height
+            );
+            return false;
+        }
+    }
+    bool cropped = roi.w != codec_ctx->width || roi.h != codec_ctx->height;
+
+    int target_width  = (target_size_.first  == 0) ? roi.w : target_size_.first;
+    int target_height = (target_size_.second == 0) ? roi.h : target_size_.second;
+
+    // Buffers of the old size are dropped, new ones are got at next conversion.
+    av_frame_unref(tmp_frame);
+    tmp_frame->format = tar_pix_fmt;
+    tmp_frame->width  = target_width;
+    tmp_frame->height = target_height;
+    sd.image_size().first = target_width;
+    sd.image_size().second = target_height;
+
+    sd.converter().reset();
+    // Gray of native size is the luma plane of decoded frames, exported without conversion.
+    bool luma = fast_convert_ && tar_pix_fmt == AV_PIX_FMT_GRAY8 && _hasLumaPlane(dec_pix_fmt);
+    if (cropped ||
+        (dec_pix_fmt != tar_pix_fmt && !luma) ||
+        (target_width != roi.w) ||
+        (target_height != roi.h)) {
+        sd.converter().setColorspace(codec_ctx->colorspace, codec_ctx->color_range);
+        sd.converter().setFastPath(fast_convert_);
+        bool ok = sd.converter().init(
+            roi.w, roi.h, dec_pix_fmt,
+            target_width, target_height, tar_pix_fmt,
+            (keyframes_only_ || lowres_ != 0) ? SWS_FAST_BILINEAR : SWS_BICUBIC, convert_threads_
+        );
+        if (!ok || !sd.converter().setCrop(roi.x, roi.y)) {
+            sd.converter().reset();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VideoReader::setRoi(Rect const & roi) {
+    this->_stopPrefetch();
+    roi_ = roi;
+    if (!isOpened()) {
+        return true;
+    }
+
+    auto & st = main_stream_data_;
+    // The converted frame is dropped, the decoded one is converted again if needed.
+    if (frame_ == st->tmp_frame()) {
+        frame_ = st->decoded();
+    }
+    prefetch_frame_.reset();
+    if (!this->_initConverter(*st)) {
+        return false;
+    }
+    return this->_initOutput();
+}
+
+bool VideoReader::_buildIndex() {
+    auto * stream = main_stream_data_->stream();
+
+    // Try the cached index first, only for files.
+    std::string cache_path;
+    SourceStat source_stat;
+    if (!index_cache_.empty() && !filename_.empty() && SourceStat::Get(filename_, source_stat)) {
+        struct stat st;
+        bool is_dir = (stat(index_cache_.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+        cache_path = (is_dir) ? FrameIndex::CachePath(index_cache_, filename_, source_stat) : index_cache_;
+        if (index_.load(cache_path, (int)main_stream_idx_, source_stat)) {
+#ifndef NDEBUG
+            spdlog::debug("load index from '{}', {} frames.", cache_path, index_.numFrames());
+#endif
+            return true;  // nothing is consumed.
+        }
+    }
+
+    if (!index_.build(fmtctx_.get(), (int)main_stream_idx_)) {
+        spdlog::warn("[vio::VideoReader]: Failed to build index, timestamps will be guessed.");
+    }
+    else if (!cache_path.empty()) {
+        index_.save(cache_path, (int)main_stream_idx_, source_stat);
+    }
+
+    // Seek back to the beginning.
+    int64_t ts = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+    if (!index_.empty()) {
+        auto const & first = index_.packet(0);
+        ts = (seek_to_pts_) ? first.pts : first.dts;
+    }
+    int ret = av_seek_frame(fmtctx_.get(), stream->index, ts, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+        spdlog::error("[vio::VideoReader]: Failed to seek back after indexing: {}.", av_err2str(ret));
+        return false;
+    }
+    avcodec_flush_buffers(main_stream_data_->codec_ctx());
+    decode_idx_ = -1;
+    return true;
+}
+
 // * -------------------------------------------------------------------------------------------------------------- * //
 // *                                             Pixel Format Conversion                                            * //
 // * -------------------------------------------------------------------------------------------------------------- * //
@@ -224,19 +428,131 @@ bool VideoReader::_findMainStream(AVPixelFormat tar_pix_fmt, std::pair<int32_t,
 
 void VideoReader::_convertPixFmt() {
     auto & st = main_stream_data_;
-    if (st->sws_ctx() && frame_ != st->tmp_frame()) {
+    if (st->converter().valid() && frame_ != st->tmp_frame()) {
+        // The last converted frame may still be referenced (zero-copy export), never overwrite it.
+        if (!EnsureFrameWritable(st->tmp_frame())) { return; }
+        this->_trackMemory();
         // Timeit _("sws_scale");
-        sws_scale(st->sws_ctx(),
-                    (const uint8_t * const *)frame_->data,
-                    frame_->linesize, 0,
-                    frame_->height,
-                    st->tmp_frame()->data,
-                    st->tmp_frame()->linesize);
+        st->converter().convert(
+            (const uint8_t * const *)frame_->data, frame_->linesize,
+            st->tmp_frame()->data, st->tmp_frame()->linesize
+        );
         st->tmp_frame()->pts = frame_->pts;
         frame_ = st->tmp_frame();
     }
 }
 
+void VideoReader::_convertPixFmt(uint8_t * data, int linesize) {
+    auto & st = main_stream_data_;
+    if (st->converter().valid() && frame_ != st->tmp_frame()) {
+        uint8_t * dst_data[4] = { data, nullptr, nullptr, nullptr };
+        int dst_linesize[4] = { linesize, 0, 0, 0 };
+        st->converter().convert((const uint8_t * const *)frame_->data, frame_->linesize, dst_data, dst_linesize);
+    }
+    else {
+        // Already in target format, just copy.
+        av_image_copy_plane(
+            data, linesize,
+            frame_->data[0], frame_->linesize[0],
+            frame_->width * this->pixelBytes(), frame_->height
+        );
+    }
+}
+
+int VideoReader::pixelBytes() const {
+    if (!isOpened()) {
+        return 0;
+    }
+    auto const * desc = av_pix_fmt_desc_get((AVPixelFormat)main_stream_data_->tmp_frame()->format);
+    return (desc) ? av_get_padded_bits_per_pixel(desc) / 8 : 0;
+}
+
+bool VideoReader::setOutput(TensorSpec const & spec) {
+    this->_stopPrefetch();
+    output_spec_ = spec;
+    return (isOpened()) ? this->_initOutput() : spec.check(spec.mean.size());
+}
+
+bool VideoReader::_initOutput() {
+    if (this->isPlanar() && !output_spec_.isImage()) {
+        spdlog::error("[vio::VideoReader]: Planar yuv is only output as uint8 planes.");
+        return false;
+    }
+    return tensor_.init(output_spec_, this->pixelBytes());
+}
+
+bool VideoReader::isPlanar() const {
+    return isOpened() && av_pix_fmt_count_planes((AVPixelFormat)main_stream_data_->tmp_frame()->format) > 1;
+}
+
+std::vector<PlaneInfo> VideoReader::planes() const {
+    std::vector<PlaneInfo> ret;
+    if (!isOpened()) {
+        return ret;
+    }
+    auto const fmt = (AVPixelFormat)main_stream_data_->tmp_frame()->format;
+    auto const * desc = av_pix_fmt_desc_get(fmt);
+    auto const size = this->imageSize();
+    int linesizes[4] = { 0, 0, 0, 0 };
+    if (!desc || av_image_fill_linesizes(linesizes, fmt, size.first) < 0) {
+        return ret;
+    }
+
+    size_t offset = 0;
+    for (int p = 0; p < av_pix_fmt_count_planes(fmt); ++p) {
+        bool chroma = (p == 1 || p == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+        int w = (chroma) ? AV_CEIL_RSHIFT(size.first,  desc->log2_chroma_w) : size.first;
+        int h = (chroma) ? AV_CEIL_RSHIFT(size.second, desc->log2_chroma_h) : size.second;
+        ret.push_back({ offset, w, h, linesizes[p] / w });
+        offset += (size_t)linesizes[p] * h;
+    }
+    return ret;
+}
+
+size_t VideoReader::outputBytes() const {
+    auto const size = this->imageSize();
+    if (this->isPlanar()) {
+        // All planes packed without padding.
+        return (size_t)av_image_get_buffer_size((AVPixelFormat)main_stream_data_->tmp_frame()->format, size.first, size.second, 1);
+    }
+    return (size_t)size.first * size.second * this->pixelBytes() * output_spec_.elementBytes();
+}
+
+void VideoReader::writeOutput(uint8_t * dst, int linesize) const {
+    auto const * frm = this->frame();
+    if (this->isPlanar()) {
+        av_image_copy_to_buffer(
+            dst, (int)this->outputBytes(), (const uint8_t * const *)frm->data, frm->linesize,
+            (AVPixelFormat)frm->format, frm->width, frm->height, 1
+        );
+        return;
+    }
+    if (output_spec_.isImage()) {
+        int const row_bytes = frm->width * this->pixelBytes();
+        av_image_copy_plane(dst, (linesize > 0) ? linesize : row_bytes, frm->data[0], frm->linesize[0], row_bytes, frm->height);
+        return;
+    }
+    tensor_.write(frm->data[0], frm->linesize[0], frm->width, frm->height, dst);
+}
+
+void VideoReader::_output(uint8_t * dst, int linesize) {
+    if (this->isPlanar()) {
+        // Planes of the decoded frame (or converted one), packed into dst.
+        this->_convertPixFmt();
+        this->writeOutput(dst);
+    }
+    else if (output_spec_.isImage()) {
+        // Convert into dst directly.
+        auto const size = this->imageSize();
+        this->_convertPixFmt(dst, (linesize > 0) ? linesize : size.first * this->pixelBytes());
+    }
+    else {
+        // Then the tensor in one pass.
+        this->_convertPixFmt();
+        tensor_.write(frame_->data[0], frame_->linesize[0], frame_->width, frame_->height, dst);
+    }
+}
+
 // * -------------------------------------------------------------------------------------------------------------- * //
 // *                                 Seeking (Also support frame-by-frame reanding)                                 * //
 // * -------------------------------------------------------------------------------------------------------------- * //
@@ -247,6 +563,10 @@ int32_t VideoReader::_ts_to_fidx(int64_t av_time) const {
         return AV_NOIDX_VALUE;
     }
 
+    if (!index_.empty()) {
+        return index_.frameIndex(av_time);
+    }
+
     auto * stream = main_stream_data_->stream();
     auto frame_idx = av_rescale_q(av_time - stream->start_time, stream->time_base, av_inv_q(stream->r_frame_rate));
     return std::max((int32_t)frame_idx, (int32_t)0);
@@ -257,6 +577,10 @@ int64_t VideoReader::_fidx_to_ts(int32_t frame_idx) const {
         return AV_NOPTS_VALUE;
     }
 
+    if (!index_.empty()) {
+        return index_.framePts(frame_idx);
+    }
+
     auto * stream = main_stream_data_->stream();
     auto timestamp = av_rescale_q(frame_idx, av_inv_q(stream->r_frame_rate), stream->time_base) + stream->start_time;
     return timestamp;
@@ -267,41 +591,82 @@ bool VideoReader::seekByFrame(int32_t frame_idx) {
         return false;
     }
 
+    this->_stopPrefetch();
+    prefetch_frame_.reset();
+    this->_adviseSeek();
+    return this->_seekByFrame(frame_idx);
+}
+
+bool VideoReader::_seekByFrame(int32_t frame_idx, bool convert) {
     auto & st = main_stream_data_;
 
+    // > Case 0: out of range, the exact frame count is known with index.
+    if (!index_.empty() && (frame_idx < 0 || frame_idx >= index_.numFrames())) {
+        return false;
+    }
+
+    if (keyframes_only_) {
+        return this->_seekKeyframe(frame_idx, convert);
+    }
+
     // > Case 1: it's same with last frame
     if (frame_ && this->_ts_to_fidx(frame_->pts) == frame_idx) {
+        // the last frame may be left unconverted by readBatch()
+        if (convert) { this->_convertPixFmt(); }
         read_idx_ = frame_idx - 1;
         return true;
     }
 
-    // > Case 2: it's in frame buffer
-    bool in_buffer = false;
-    for (size_t i = 0; i < st->buffer().size(); ++i) {
-        auto * frm = st->buffer().offset_front(i);
-        if (this->_ts_to_fidx(frm->pts) == frame_idx) {
+    // Non-reference frames are discarded, the target may never come out. Take the first one at or after.
+    bool const at_or_after = st->codec_ctx()->skip_frame >= AVDISCARD_NONREF;
+
+    // > Case 2: it's in frame cache
+    auto const * cached = st->cache().get(frame_idx);
+    if (cached) {
 #ifndef NDEBUG
-            spdlog::debug("find in buffer! {}, {}, {}", frm->pts, this->_ts_to_fidx(frm->pts), frame_idx);
+        spdlog::debug("find in cache! {}, {}", cached->pts, frame_idx);
 #endif
-            in_buffer = true;
-            frame_ = frm;
-            break;
-        }
+        av_frame_unref(st->decoded());
+        av_frame_ref(st->decoded(), cached);
+        frame_ = st->decoded();
     }
 
-    // > Case 3: not in buffer
-    if (!in_buffer) {
-        auto last_idx = (frame_) ? this->_ts_to_fidx(frame_->pts) : -1000;
+    // > Case 3: not in cache
+    if (!cached) {
+        // Decide with the position of decoder, frame_ may come from cache.
+        auto last_idx = decode_idx_;
+        int32_t cur = last_idx;
 
-        // ! HACK: If we are close to target future frame index, don't seek.
-        if (last_idx + SEEKING_TRIGGER_HOP < frame_idx || last_idx > frame_idx) {
+        // Seek only if it's faster than decoding forward, with key frame positions and measured costs.
+        bool need_seek = seek_policy_.shouldSeek(last_idx, frame_idx, index_);
+        bool seeking = need_seek;
+        auto seek_start = std::chrono::steady_clock::now();
+
+        if (need_seek) {
+            seek_policy_.onSeek();
             // seek the nearest key frame
             auto * stream = st->stream();
             auto pts = _fidx_to_ts(frame_idx);
             // Seek back to keyframe
-            if (this->_seekToPTS()) {
+            if (!index_.empty()) {
+                // Jump to the right key packet directly.
+                auto const & key = index_.packet(index_.seekPacket(frame_idx));
+                avcodec_flush_buffers(st->codec_ctx());
+                av_seek_frame(fmtctx_.get(), stream->index, (this->_seekToPTS()) ? key.pts : key.dts, AVSEEK_FLAG_BACKWARD);
+                cur = AV_NOIDX_VALUE;
+#ifndef NDEBUG
+                spdlog::debug(
+                    "seek frame: {}, key pts: {}, {}",
+                    frame_idx,
+                    AVTime2MS(key.pts, stream->time_base),
+                    _ts_to_fidx(key.pts)
+                );
+#endif
+            }
+            else if (this->_seekToPTS()) {
                 avcodec_flush_buffers(st->codec_ctx());
                 av_seek_frame(fmtctx_.get(), stream->index, pts, AVSEEK_FLAG_BACKWARD);
+                cur = AV_NOIDX_VALUE;
 #ifndef NDEBUG
                 spdlog::debug(
                     "seek frame: {}, pts: {}, {}",
@@ -332,28 +697,38 @@ bool VideoReader::seekByFrame(int32_t frame_idx) {
                     // Update the dts_pts_delta guessing.
                     dts_pts_delta_ += pts - frame_->pts;
                 } while (true);
+                cur = decode_idx_;
+                seek_policy_.addSeekCost(
+                    cast<MsDouble>(std::chrono::steady_clock::now() - seek_start).count() - seek_policy_.decodeCost()
+                );
+                seeking = false;
             }
         }
         else {
 #ifndef NDEBUG
-            spdlog::debug("near frame: {}, {}, {}", last_idx, frame_idx, SEEKING_TRIGGER_HOP);
+            spdlog::debug("near frame: {}, {}, decode forward", last_idx, frame_idx);
 #endif
         }
 
         // read until the right frame
-        int32_t cur = -1;
-        if (frame_) {
-            cur = this->_ts_to_fidx(frame_->pts);
-        }
-
         // ! cannot use 'cur < frame_idx' to judge, due to B-frame (need future frames to decode)
-        // while (cur != frame_idx) {
-        while (cur != frame_idx) {
+        // ! unless non-reference frames are discarded, frames come out after seeking are in presentation order.
+        while ((at_or_after) ? (cur == AV_NOIDX_VALUE || cur < frame_idx) : (cur != frame_idx)) {
+            auto start = std::chrono::steady_clock::now();
             // No frame got.
             if (!this->_getFrame()) {
                 return false;
             }
-            cur = this->_ts_to_fidx(frame_->pts);
+            cur = decode_idx_;
+            // The first frame after seeking also includes the cost to refill the decoder.
+            auto end = std::chrono::steady_clock::now();
+            if (seeking) {
+                seek_policy_.addSeekCost(cast<MsDouble>(end - seek_start).count() - seek_policy_.decodeCost());
+                seeking = false;
+            }
+            else {
+                seek_policy_.addDecodeCost(cast<MsDouble>(end - start).count());
+            }
 #ifndef NDEBUG
             spdlog::debug("  got frame at {}, {}", AVTime2MS(frame_->pts, st->stream()->time_base), cur);
             Timestamp pts(0);
@@ -364,7 +739,7 @@ bool VideoReader::seekByFrame(int32_t frame_idx) {
     }
 
     // convert pixel format of frame_
-    this->_convertPixFmt();
+    if (convert) { this->_convertPixFmt(); }
     read_idx_ = frame_idx - 1;
     return true;
 }
@@ -384,17 +759,329 @@ bool VideoReader::read() {
         return false;
     }
 
+    if (prefetch_size_ == 0) {
+        this->_adviseRead();
+        prefetch_frame_.reset();
+        return this->_read();
+    }
+
+    // Start the worker from current position, it reads ahead sequentially.
+    if (!prefetch_thread_.joinable()) {
+        this->_adviseSequential();
+        prefetch_idx_ = read_idx_;
+        prefetch_thread_ = std::thread(&VideoReader::_prefetchLoop, this);
+    }
+
+    std::pair<int32_t, AVFrame *> item;
+    {
+        std::unique_lock<std::mutex> lock(prefetch_mutex_);
+        prefetch_cv_.wait(lock, [this]() { return !prefetch_queue_.empty(); });
+        item = prefetch_queue_.front();
+        prefetch_queue_.pop_front();
+        if (item.second) { prefetch_bytes_ -= FrameBytes(item.second); }
+    }
+    prefetch_cv_.notify_all();
+
+    prefetch_idx_ = item.first;
+    if (!item.second) {
+        // The worker exits after eof or error.
+        prefetch_thread_.join();
+        return false;
+    }
+    prefetch_frame_.reset(item.second);
+    return true;
+}
+
+bool VideoReader::_read(bool convert) {
+    if (keyframes_only_) {
+        return this->_readKeyframe(convert);
+    }
+
     int32_t new_idx = read_idx_ + 1;
-    bool got = this->seekByFrame(new_idx);
-    read_idx_ = new_idx;
+    bool got = this->_seekByFrame(new_idx, convert);
+    // Skip the frames dropped by sampling, read_idx_ is the one before next frame.
+    read_idx_ = new_idx + this->_step() - 1;
 
     return got;
 }
 
+bool VideoReader::_seekKeyframe(int32_t frame_idx, bool convert) {
+    auto & st = main_stream_data_;
+    auto * stream = st->stream();
+
+    // Seek to the key frame at or before, which is the first one decoded.
+    int64_t ts = 0;
+    if (!index_.empty()) {
+        auto const & key = index_.packet(index_.seekPacket(frame_idx));
+        ts = (this->_seekToPTS()) ? key.pts : key.dts;
+    }
+    else {
+        ts = _fidx_to_ts(frame_idx) + ((this->_seekToPTS()) ? 0 : dts_pts_delta_);
+    }
+    avcodec_flush_buffers(st->codec_ctx());
+    av_packet_unref(&st->packet());
+    if (av_seek_frame(fmtctx_.get(), stream->index, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+        return false;
+    }
+    if (!this->_getFrame()) {
+        return false;
+    }
+
+    if (convert) { this->_convertPixFmt(); }
+    read_idx_ = decode_idx_ - 1;
+    return true;
+}
+
+bool VideoReader::_readKeyframe(bool convert) {
+    int32_t want = read_idx_ + 1;
+
+    // The decoder has gone past (e.g. prefetched frames are dropped), seek back.
+    if (frame_ && decode_idx_ > want && !this->_seekKeyframe(want, false)) {
+        return false;
+    }
+    // The first key frame at or after.
+    while (!frame_ || decode_idx_ < want) {
+        if (!this->_getFrame()) {
+            return false;
+        }
+    }
+
+    if (convert) { this->_convertPixFmt(); }
+    read_idx_ = decode_idx_;
+    return true;
+}
+
+bool VideoReader::readInto(uint8_t * data, int linesize) {
+    if (!this->isOpened()) {
+        return false;
+    }
+
+    if (prefetch_size_ > 0) {
+        // Frames are already converted by the worker.
+        if (!this->read()) { return false; }
+        this->writeOutput(data, linesize);
+    }
+    else {
+        this->_adviseRead();
+        prefetch_frame_.reset();
+        if (!this->_read(false)) { return false; }
+        this->_output(data, linesize);
+    }
+    return true;
+}
+
+bool VideoReader::seekAndReadInto(int32_t frame_idx, uint8_t * data, int linesize) {
+    if (!this->isOpened()) {
+        return false;
+    }
+
+    this->_stopPrefetch();
+    prefetch_frame_.reset();
+    this->_adviseSeek();
+    // The frame got by seeking is the next one to read, it's not decoded again.
+    if (!this->_seekByFrame(frame_idx, false) || !this->_read(false)) {
+        return false;
+    }
+    this->_output(data, linesize);
+    return true;
+}
+
+int32_t VideoReader::readBatch(uint8_t * data, int32_t n) {
+    if (!this->isOpened()) {
+        return 0;
+    }
+
+    size_t const frame_bytes = this->outputBytes();
+
+    this->_adviseSequential();
+    int32_t i = 0;
+    for (; i < n; ++i) {
+        if (!this->readInto(data + frame_bytes * i)) { break; }
+    }
+    return i;
+}
+
+bool VideoReader::getFrames(std::vector<int32_t> const & indices, uint8_t * data) {
+    if (!this->isOpened()) {
+        return false;
+    }
+
+    this->_stopPrefetch();
+    prefetch_frame_.reset();
+    this->_adviseSeek();
+
+    size_t const frame_bytes = this->outputBytes();
+
+    // Decode in ascending order, so that each GOP is entered (seeked to) once at most.
+    std::vector<size_t> order(indices.size());
+    for (size_t i = 0; i < order.size(); ++i) { order[i] = i; }
+    std::stable_sort(order.begin(), order.end(), [&indices](size_t a, size_t b) {
+        return indices[a] < indices[b];
+    });
+
+    uint8_t * last = nullptr;
+    for (size_t k = 0; k < order.size(); ++k) {
+        auto const frame_idx = indices[order[k]];
+        uint8_t * dst = data + frame_bytes * order[k];
+        if (k > 0 && frame_idx == indices[order[k - 1]]) {
+            // Duplicated index.
+            memcpy(dst, last, frame_bytes);
+            continue;
+        }
+        if (!this->_seekByFrame(frame_idx, false)) {
+            return false;
+        }
+        this->_output(dst, 0);
+        last = dst;
+    }
+    return true;
+}
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                   Prefetching                                                  * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+void VideoReader::setCacheBudget(size_t bytes) {
+    this->_stopPrefetch();
+    cache_budget_ = bytes;
+    if (isOpened()) {
+        main_stream_data_->cache().set_budget(bytes);
+    }
+}
+
+void VideoReader::setConvertThreads(int n) {
+    this->_stopPrefetch();
+    convert_threads_ = std::max(n, 1);
+    if (isOpened()) {
+        main_stream_data_->converter().setThreads(convert_threads_);
+    }
+}
+
+void VideoReader::setStride(int n) {
+    this->_stopPrefetch();
+    stride_ = std::max(n, 1);
+    sample_fps_ = 0.0;
+    this->_setDiscard();
+}
+
+void VideoReader::setSampleFps(double fps) {
+    this->_stopPrefetch();
+    sample_fps_ = std::max(fps, 0.0);
+    this->_setDiscard();
+}
+
+int32_t VideoReader::_step() const {
+    if (sample_fps_ > 0.0 && tbr_.num > 0 && tbr_.den > 0) {
+        return std::max((int32_t)std::lround(av_q2d(tbr_) / sample_fps_), (int32_t)1);
+    }
+    return stride_;
+}
+
+void VideoReader::_setDiscard() {
+    if (!isOpened()) {
+        return;
+    }
+    // Frame threads take the new value with next packets.
+    auto * codec_ctx = main_stream_data_->codec_ctx();
+    if      (keyframes_only_)     { codec_ctx->skip_frame = AVDISCARD_NONKEY;   }
+    else if (this->_step() > 1)   { codec_ctx->skip_frame = AVDISCARD_NONREF;   }
+    else                          { codec_ctx->skip_frame = AVDISCARD_DEFAULT; }
+}
+
+void VideoReader::setPrefetch(size_t n) {
+    this->_stopPrefetch();
+    prefetch_size_ = n;
+}
+
+void VideoReader::_prefetchLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(prefetch_mutex_);
+            prefetch_cv_.wait(lock, [this]() {
+                return prefetch_stop_ || prefetch_queue_.size() < prefetch_size_;
+            });
+            if (prefetch_stop_) {
+                break;
+            }
+        }
+
+        // Decode and convert, then reference the result. The converted frame won't be overwritten,
+        // since the next conversion gets new buffers when the old ones are still referenced.
+        AVFrame * ref = nullptr;
+        if (this->_read()) {
+            ref = av_frame_clone(frame_);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex_);
+            prefetch_queue_.emplace_back(read_idx_, ref);
+            if (ref) { prefetch_bytes_ += FrameBytes(ref); }
+        }
+        prefetch_cv_.notify_all();
+        this->_trackMemory();
+
+        if (!ref) {
+            break;
+        }
+    }
+}
+
+void VideoReader::_stopPrefetch() {
+    if (!prefetch_thread_.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex_);
+        prefetch_stop_ = true;
+    }
+    prefetch_cv_.notify_all();
+    if (wait_fn_) {
+        wait_fn_([this]() { prefetch_thread_.join(); });
+    }
+    else {
+        prefetch_thread_.join();
+    }
+
+    for (auto & item : prefetch_queue_) {
+        av_frame_free(&item.second);
+    }
+    prefetch_queue_.clear();
+    prefetch_bytes_ = 0;
+    prefetch_stop_ = false;
+
+    // The decoder may be ahead, rewind to the frame last given out.
+    read_idx_ = prefetch_idx_;
+}
+
 // * -------------------------------------------------------------------------------------------------------------- * //
 // *                                                    Decoding                                                    * //
 // * -------------------------------------------------------------------------------------------------------------- * //
 
+void VideoReader::_adviseSeek() {
+    sequential_reads_ = 0;
+    this->_advise(IOAccess::Random);
+}
+
+void VideoReader::_adviseRead() {
+    // Hinted once, when reads since the last seek make a run.
+    if (sequential_reads_ < kSequentialRun && ++sequential_reads_ == kSequentialRun) {
+        this->_advise(IOAccess::Sequential);
+    }
+}
+
+void VideoReader::_adviseSequential() {
+    sequential_reads_ = kSequentialRun;
+    this->_advise(IOAccess::Sequential);
+}
+
+void VideoReader::_trackMemory() {
+    auto & st = main_stream_data_;
+    size_t bytes = st->cache().bytes() + FrameBytes(st->tmp_frame()) + prefetch_bytes_;
+    size_t peak = peak_memory_.load();
+    while (bytes > peak && !peak_memory_.compare_exchange_weak(peak, bytes)) {}
+}
+
 int VideoReader::_readPacket(AVPacket * pkt) {
     int ret = av_read_frame(fmtctx_.get(), pkt);
     switch (ret) {
@@ -408,6 +1095,10 @@ int VideoReader::_readPacket(AVPacket * pkt) {
         if (pkt->stream_index != (int)main_stream_idx_) {
             ret = AVERROR(EAGAIN);  // HACK: abuse EAGAIN to ignore other streams.
         }
+        else if (keyframes_only_ && !(pkt->flags & AV_PKT_FLAG_KEY)) {
+            av_packet_unref(pkt);  // never sent to the decoder
+            ret = AVERROR(EAGAIN);
+        }
         break;
     }
 
@@ -431,12 +1122,23 @@ bool VideoReader::_getFrame() {
     auto _decodeFrame = [&]() -> int {
         int ret = avcodec_receive_frame(codec_ctx, st->frame());
         if (ret == 0) {
-            // new frame
-            st->buffer().push_back();
-            AVFrame * new_frame = st->buffer().offset_back(0);
-            av_frame_copy(new_frame, st->frame());
-            av_frame_copy_props(new_frame, st->frame());
+            // new frame, take over the reference without copying pixels.
+            AVFrame * new_frame = st->decoded();
+            av_frame_unref(new_frame);
+            av_frame_move_ref(new_frame, st->frame());
             new_frame->pts = new_frame->best_effort_timestamp;
+            decode_idx_ = this->_ts_to_fidx(new_frame->pts);
+            if (index_.empty()) {
+#ifdef AV_FRAME_FLAG_KEY
+                seek_policy_.addFrame(decode_idx_, (new_frame->flags & AV_FRAME_FLAG_KEY) != 0);
+#else
+                seek_policy_.addFrame(decode_idx_, new_frame->key_frame != 0);
+#endif
+            }
+            if (decode_idx_ != AV_NOIDX_VALUE) {
+                st->cache().put(decode_idx_, new_frame);
+                this->_trackMemory();
+            }
             // set to new frame
             frame_ = new_frame;
         }
@@ -511,8 +1213,10 @@ bool VideoReader::_getFrame() {
             }
         }
         else {
-            spdlog::error("  (_readPacket) {}", av_err2str(ret));
-            exit(1);
+            // e.g. a stream source failed, the read fails instead of the process.
+            av_packet_unref(&pkt);
+            spdlog::error("[vio::VideoReader] Failed to read packet: {}", av_err2str(ret));
+            return false;
         }
     } while (true);
 
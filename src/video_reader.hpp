@@ -1,15 +1,52 @@
 #pragma once
 #include <string>
 #include <memory>
-#include "avio.hpp"
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include "avio_stream.hpp"
 #include "stream.hpp"
+#include "frame_index.hpp"
+#include "seek_policy.hpp"
+#include "tensor.hpp"
 
 namespace vio {
 
+// By default the decoded frame cache holds about this many frames of the stream (sized at open),
+// and at least kDefaultCacheBudget bytes (about 20 frames of 1080p yuv420p).
+constexpr size_t kDefaultCacheFrames = 20;
+constexpr size_t kDefaultCacheBudget = (size_t)64 << 20;
+// Size the cache budget by the stream at open.
+constexpr size_t kCacheBudgetAuto = (size_t)-1;
+// Choose the lowres factor by target resolution.
+constexpr int kLowresAuto = -1;
+
+// Output the decoded planes of 8-bit planar yuv (e.g. yuv420p, nv12), or yuv420p for other formats.
+constexpr char const * kNativeYuv = "yuv";
+
+// A plane of planar output, in the packed buffer of outputBytes().
+struct PlaneInfo {
+    size_t offset;
+    int32_t width, height;
+    int32_t channels;  // bytes per pixel, e.g. 2 for the interleaved uv of nv12
+};
+
+// A rectangle in pixels, empty for none.
+struct Rect {
+    int32_t x, y, w, h;
+    bool empty() const { return w <= 0 || h <= 0; }
+};
+
 class VideoReader {
 public:
     VideoReader()
-        : ioctx_(nullptr)
+        : io_mode_(IOMode::Mmap)
+        , readahead_(kDefaultReadAhead)
+        , sequential_reads_(0)
+        , ioctx_(nullptr)
         , fmtctx_(nullptr, [](AVFormatContext * p) { avformat_free_context(p); })
         , main_stream_idx_(0)
         , main_stream_data_(nullptr)
@@ -17,23 +54,59 @@ public:
         , fps_({1, 0}), tbr_({1, 0})
         , frame_(nullptr)
         , read_idx_(-1)
+        , decode_idx_(-1)
         , seek_to_pts_(true)
         , dts_pts_delta_(0)
+        , seek_policy_()
+        , indexing_(false)
+        , index_cache_()
+        , index_()
+        , cache_budget_(kCacheBudgetAuto)
+        , target_size_(0, 0)
+        , roi_({0, 0, 0, 0})
+        , convert_threads_(1)
+        , fast_convert_(true)
+        , output_spec_()
+        , tensor_()
+        , keyframes_only_(false)
+        , lowres_(0)
+        , stride_(1)
+        , sample_fps_(0.0)
+        , prefetch_size_(0)
+        , prefetch_stop_(false)
+        , prefetch_idx_(-1)
+        , prefetch_frame_(nullptr, [](AVFrame * p) { if (p) { av_frame_free(&p); } })
+        , prefetch_bytes_(0)
+        , peak_memory_(0)
     {}
     ~VideoReader() {
         this->close();
     }
 
     bool open(std::string const & filename, std::string target_pix_fmt = "bgr24", std::pair<int32_t, int32_t> const & target_resolution = {0, 0});
-    bool open(const uint8_t * data, size_t size, std::string target_pix_fmt = "bgr24", std::pair<int32_t, int32_t> const & target_resolution = {0, 0});
+    // The memory is read in place. 'owner' (if given) is held until closing, to keep the memory alive.
+    bool open(const uint8_t * data, size_t size, std::string target_pix_fmt = "bgr24", std::pair<int32_t, int32_t> const & target_resolution = {0, 0},
+              std::shared_ptr<void const> owner = nullptr);
+    // Reads a custom IO, e.g. an AVStreamIOContext. Non-seekable inputs are read sequentially and not indexed.
+    bool open(std::unique_ptr<AVIOBase> ioctx, std::string target_pix_fmt = "bgr24", std::pair<int32_t, int32_t> const & target_resolution = {0, 0});
     bool isOpened() const { return main_stream_data_ != nullptr; }
     void close();
 
+    // How files are read, set before opening. Files are memory-mapped by default.
+    void setIOMode(IOMode mode) { io_mode_ = mode; }
+    auto ioMode() const -> IOMode { return io_mode_; }
+    // Bytes read ahead of the demuxer by IOMode::ReadAhead, e.g. 8 ~ 64 MB for network filesystems.
+    void setReadAhead(size_t bytes) { readahead_ = bytes; }
+    auto readAhead() const -> size_t { return readahead_; }
+    // Counters of the input, e.g. bytes read and the time waiting for them with read-ahead.
+    auto ioStats() const -> IOStats { return (ioctx_) ? ioctx_->stats() : IOStats(); }
+
     auto fps() const -> AVRational { return fps_; }
     auto tbr() const -> AVRational { return tbr_; }
     auto duration() const -> Millisecond const { return (isOpened()) ? duration_ : Millisecond(0); }
     auto numFrames() const -> uint64_t {
         if (isOpened()) {
+            if (!index_.empty()) return (uint64_t)index_.numFrames();  // exact
             uint64_t ret = main_stream_data_->stream()->nb_frames;
             if (ret == 0) ret = (uint64_t)((double)duration_.count() / 1000.0 * fps_.num / fps_.den);
             return ret;
@@ -41,25 +114,112 @@ public:
         return 0;
     }
     auto imageSize() const -> std::pair<int, int> { return (isOpened()) ? main_stream_data_->image_size() : std::pair<int, int>(0, 0);}
+    auto pixelBytes() const -> int;  // bytes per pixel of the (packed) output image
+    // Planar yuv output: frames are the planes packed one after another, without padding.
+    auto isPlanar() const -> bool;
+    auto planes() const -> std::vector<PlaneInfo>;
     Millisecond currMillisecond() const {
         return (isOpened())
-            ? ((frame_) ? AVTime2MS(frame_->pts, main_stream_data_->stream()->time_base) : Millisecond(0))
+            ? ((frame()) ? AVTime2MS(frame()->pts, main_stream_data_->stream()->time_base) : Millisecond(0))
             : kNoTimestamp;
     }
     int32_t currFrameIndex() const {
         return (isOpened())
-            ? ((frame_) ? _ts_to_fidx(frame_->pts) : 0)
+            ? ((frame()) ? _ts_to_fidx(frame()->pts) : 0)
             : -1;
     }
 
     auto read() -> bool;
     auto seekByFrame(int32_t) -> bool;
     auto seekByTime(Millisecond ms) -> bool;
-    auto frame() const -> const AVFrame * { return frame_; }
+    auto frame() const -> const AVFrame * { return (prefetch_frame_) ? prefetch_frame_.get() : frame_; }
+
+    // Read next frame into 'data', converted straight into it without intermediate frames.
+    // Images have rows of 'linesize' bytes (0 for packed rows), other outputs are contiguous tensors.
+    auto readInto(uint8_t * data, int linesize = 0) -> bool;
+    // Seek then read the frame into 'data', as readInto().
+    auto seekAndReadInto(int32_t frame_idx, uint8_t * data, int linesize = 0) -> bool;
+    // Read at most n consecutive frames into 'data', which holds n contiguous frames of outputBytes().
+    // Frames are converted straight into 'data'. Returns the number of frames read.
+    auto readBatch(uint8_t * data, int32_t n) -> int32_t;
+    // Get frames of given indices into 'data', in the given order. Indices are decoded in ascending order,
+    // each GOP is decoded once. Returns false if any frame is not got.
+    auto getFrames(std::vector<int32_t> const & indices, uint8_t * data) -> bool;
+
+    // Layout, type and normalization of output frames (for readBatch, getFrames and writeOutput).
+    // It's checked with the channels of pixel format when opening.
+    auto setOutput(TensorSpec const & spec) -> bool;
+    auto output() const -> TensorSpec const & { return output_spec_; }
+    auto outputBytes() const -> size_t;
+    // Write the current frame into 'data' as the output spec, linesize is for images as readInto().
+    void writeOutput(uint8_t * data, int linesize = 0) const;
+
+    // Build the packet index of main stream when opening. It gives exact frame count and faster, accurate seeking.
+    void setIndexing(bool indexing) { indexing_ = indexing; }
+    auto indexing() const -> bool { return indexing_; }
+    auto isIndexed() const -> bool { return !index_.empty(); }
+    // Cache the index of files. 'path' is a directory (index files are keyed by path, size and mtime of videos),
+    // or a sidecar index file. Empty to disable. The cached index is memory-mapped without scanning the video.
+    void setIndexCache(std::string const & path) { index_cache_ = path; }
+    auto indexCache() const -> std::string const & { return index_cache_; }
+
+    // Decoded frames are cached with LRU eviction, in a byte budget. 0 disables caching.
+    // kCacheBudgetAuto (default) is kDefaultCacheFrames frames of the stream. The counters can be read while prefetching.
+    void setCacheBudget(size_t bytes);
+    auto cacheBudget() const -> size_t { return (isOpened()) ? main_stream_data_->cache().budget() : cache_budget_; }
+    auto cacheBytes()  const -> size_t   { return (isOpened()) ? main_stream_data_->cache().bytes()  : 0; }
+    auto cacheHits()   const -> uint64_t { return (isOpened()) ? main_stream_data_->cache().hits()   : 0; }
+    auto cacheMisses() const -> uint64_t { return (isOpened()) ? main_stream_data_->cache().misses() : 0; }
+
+    // Region of interest of decoded images, only the region is converted (and scaled to the target resolution,
+    // or kept in size without it). Empty for whole images. It can be changed anytime, false if it's out of images.
+    auto setRoi(Rect const & roi) -> bool;
+    auto roi() const -> Rect const & { return roi_; }
+
+    // Convert pixel format in n threads, each converts a horizontal slice of the image.
+    // Only for unscaled conversion (target resolution and roi size equal), scaling is single-threaded.
+    void setConvertThreads(int n);
+    auto convertThreads() const -> int { return convert_threads_; }
+    // Convert yuv420p / nv12 into rgb with simd kernels rather than swscale, when the size is kept. Set before opening.
+    void setFastConvert(bool enable) { fast_convert_ = enable; }
+    auto fastConvert() const -> bool { return fast_convert_; }
+
+    // Thumbnail decoding, set before opening.
+    // Only decode key frames: read() returns the next key frame, seeking goes to the key frame at or before.
+    void setKeyframesOnly(bool enable) { keyframes_only_ = enable; }
+    auto keyframesOnly() const -> bool { return keyframes_only_; }
+    // Decode at 1/2^n of the size, if the codec supports (e.g. mjpeg, mpeg4), clamped to its max.
+    // kLowresAuto picks the largest n keeping the target resolution. With either, images are scaled by fast bilinear.
+    void setLowres(int n) { lowres_ = n; }
+    auto lowres() const -> int { return lowres_; }
+
+    // Sampling: read() steps 'stride' frames, or round(fps / sample_fps) frames if sample_fps > 0.
+    // Only kept frames are converted, and the decoder discards non-reference frames when stride > 1,
+    // so a kept frame is the first decodable one at or after its index (the same when it's a reference frame).
+    // Seeking goes forward instead of decoding when the stride spans more than a GOP.
+    void setStride(int n);
+    void setSampleFps(double fps);
+    auto stride() const -> int { return stride_; }
+    auto sampleFps() const -> double { return sample_fps_; }
+
+    // Decode (and convert) at most n frames ahead in a worker thread. 0 disables prefetching.
+    void setPrefetch(size_t n);
+    // Waits for the prefetch worker through this, e.g. without the python gil the worker's input may need.
+    void setWaitFn(WaitFn fn) { wait_fn_ = std::move(fn); }
+    auto prefetchSize() const -> size_t { return prefetch_size_; }
+
+    // Peak bytes of frames held by this reader since opening: cached, converted and prefetched ones.
+    // Frames owned by the decoder (e.g. its reference frames) are not counted.
+    auto peakMemory() const -> size_t { return peak_memory_; }
 
 private:
 public:
     // The file IO and format context
+    IOMode io_mode_;
+    size_t readahead_;
+    int32_t sequential_reads_;  // reads since the last seek, hinted sequential after a run of them
+    std::string filename_;  // empty for memory input
+    std::shared_ptr<void const> input_owner_;  // owner of input memory
     std::unique_ptr<AVIOBase> ioctx_;
     std::unique_ptr<AVFormatContext, void(*)(AVFormatContext *)> fmtctx_;
     // The main stream
@@ -75,23 +235,89 @@ public:
     // for decoding, reading and seeking
     AVFrame const * frame_;
     int32_t read_idx_;
+    int32_t decode_idx_;  // index of the frame last output by decoder, -1 before the first one.
     bool seek_to_pts_;
     int64_t dts_pts_delta_;
+    SeekPolicy seek_policy_;
+
+    // packet index
+    bool indexing_;
+    std::string index_cache_;
+    FrameIndex index_;
+
+    // frame cache
+    size_t cache_budget_;
+
+    // pixel format conversion
+    std::pair<int32_t, int32_t> target_size_;  // given when opening, 0 to keep
+    Rect roi_;
+    int convert_threads_;
+    bool fast_convert_;
+    TensorSpec output_spec_;
+    TensorWriter tensor_;
+
+    // thumbnail decoding
+    bool keyframes_only_;
+    int lowres_;
+
+    // sampling
+    int stride_;
+    double sample_fps_;
+
+    // for prefetching. The worker owns all decoding states above while it's running.
+    size_t prefetch_size_;
+    std::thread prefetch_thread_;
+    WaitFn wait_fn_;
+    std::mutex prefetch_mutex_;
+    std::condition_variable prefetch_cv_;
+    std::deque<std::pair<int32_t, AVFrame *>> prefetch_queue_;  // (frame index, frame), nullptr for eof
+    bool prefetch_stop_;
+    int32_t prefetch_idx_;  // index of the frame last given out
+    std::unique_ptr<AVFrame, void(*)(AVFrame *)> prefetch_frame_;
+    std::atomic<size_t> prefetch_bytes_;  // bytes of frames in the queue
+
+    // memory usage
+    std::atomic<size_t> peak_memory_;
 
     auto _open(std::string target_pix_fmt, std::pair<int32_t, int32_t> const & target_resolution) -> bool;
     auto _findMainStream(AVPixelFormat tar_pix_fmt, std::pair<int32_t, int32_t> const & target_resolution) -> bool;
+    auto _initConverter(InputStreamData & sd) -> bool;
+    auto _initOutput() -> bool;
+    auto _read(bool convert = true) -> bool;
+    auto _seekByFrame(int32_t, bool convert = true) -> bool;
+    auto _readKeyframe(bool convert) -> bool;
+    auto _seekKeyframe(int32_t, bool convert) -> bool;
+    auto _buildIndex() -> bool;
     auto _getFrame() -> bool;
     auto _readPacket(AVPacket *) -> int;
     void _convertPixFmt();
+    void _convertPixFmt(uint8_t * data, int linesize);
+    void _output(uint8_t * data, int linesize);
+    void _prefetchLoop();
+    void _stopPrefetch();
+    void _trackMemory();
+    void _advise(IOAccess access) { if (ioctx_) { ioctx_->advise(access); } }
+    void _adviseSeek();
+    void _adviseRead();
+    void _adviseSequential();
+    auto _step() const -> int32_t;
+    void _setDiscard();
     int64_t _fidx_to_ts(int32_t) const;
     int32_t _ts_to_fidx(int64_t) const;
 
     auto _seekToPTS() const -> bool { return seek_to_pts_; }
 
     void _cleanup() {
+        this->_stopPrefetch();
+        prefetch_frame_.reset();
+        prefetch_idx_ = -1;
+        peak_memory_ = 0;
         dts_pts_delta_ = 0;
+        seek_policy_.reset();
+        index_.clear();
         seek_to_pts_ = true;
         read_idx_ = -1;
+        decode_idx_ = -1;
         frame_ = nullptr;
         fps_ = tbr_ = {1, 0};
         start_time_ = duration_ = kNoTimestamp;
@@ -99,6 +325,8 @@ public:
         main_stream_idx_ = 0;
         fmtctx_.reset();
         ioctx_.reset();
+        input_owner_.reset();
+        filename_.clear();
     }
 };
 
@@ -0,0 +1,333 @@
+#include <cmath>
+#include <cstring>
+#include "yuv2rgb.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VIO_YUV2RGB_X86
+#include <immintrin.h>
+#endif
+
+namespace vio {
+
+// Byte orders of packed output.
+enum Layout { kBGR, kRGB, kBGRA, kRGBA };
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                    Plain C                                                     * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+// Same as _mm_mulhrs_epi16 and _mm_adds_epi16, so that all kernels agree.
+static inline int16_t _mulhrs(int16_t a, int16_t b) {
+    return (int16_t)(((int32_t)a * b + (1 << 14)) >> 15);
+}
+static inline int16_t _adds(int32_t a, int32_t b) {
+    int32_t s = a + b;
+    return (int16_t)((s > INT16_MAX) ? INT16_MAX : (s < INT16_MIN) ? INT16_MIN : s);
+}
+static inline uint8_t _pack(int16_t x) {
+    int32_t v = _adds(x, 32) >> 6;
+    return (uint8_t)((v > 255) ? 255 : (v < 0) ? 0 : v);
+}
+
+template <bool kNV12, int kLayout>
+static int _rowC(uint8_t const * y, uint8_t const * u, uint8_t const * v, uint8_t * dst, int width, YuvToRgb::Coefs const & c) {
+    constexpr int bpp = (kLayout == kBGRA || kLayout == kRGBA) ? 4 : 3;
+    constexpr bool rgb = (kLayout == kRGB || kLayout == kRGBA);
+    for (int x = 0; x < width; ++x) {
+        int ci = (kNV12) ? (x >> 1) * 2 : (x >> 1);
+        int16_t uu = (int16_t)((u[ci] - 128) * 256);
+        int16_t vv = (int16_t)((v[ci] - 128) * 256);
+        int16_t yy = _mulhrs((int16_t)((y[x] - c.y_off) * 128), c.y_mul);
+        uint8_t r = _pack(_adds(yy, _mulhrs(vv, c.rv)));
+        uint8_t g = _pack(_adds(yy, _adds(_mulhrs(uu, c.gu), _mulhrs(vv, c.gv))));
+        uint8_t b = _pack(_adds(yy, _mulhrs(uu, c.bu)));
+        uint8_t * p = dst + x * bpp;
+        p[0] = (rgb) ? r : b;
+        p[1] = g;
+        p[2] = (rgb) ? b : r;
+        if (bpp == 4) p[3] = 255;
+    }
+    return width;
+}
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                  SSE4.1, AVX2                                                  * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+#ifdef VIO_YUV2RGB_X86
+
+// Interleave and store 16 pixels of r, g, b.
+template <int kLayout>
+__attribute__((target("sse4.1"), always_inline))
+static inline void _store16(uint8_t * dst, __m128i r, __m128i g, __m128i b) {
+    constexpr bool rgb = (kLayout == kRGB || kLayout == kRGBA);
+    __m128i const a  = _mm_set1_epi8((char)0xff);
+    __m128i const c0 = (rgb) ? r : b;
+    __m128i const c2 = (rgb) ? b : r;
+    __m128i lo01 = _mm_unpacklo_epi8(c0, g);
+    __m128i hi01 = _mm_unpackhi_epi8(c0, g);
+    __m128i lo2a = _mm_unpacklo_epi8(c2, a);
+    __m128i hi2a = _mm_unpackhi_epi8(c2, a);
+    __m128i p0 = _mm_unpacklo_epi16(lo01, lo2a);
+    __m128i p1 = _mm_unpackhi_epi16(lo01, lo2a);
+    __m128i p2 = _mm_unpacklo_epi16(hi01, hi2a);
+    __m128i p3 = _mm_unpackhi_epi16(hi01, hi2a);
+    if (kLayout == kBGRA || kLayout == kRGBA) {
+        _mm_storeu_si128((__m128i *)(dst +  0), p0);
+        _mm_storeu_si128((__m128i *)(dst + 16), p1);
+        _mm_storeu_si128((__m128i *)(dst + 32), p2);
+        _mm_storeu_si128((__m128i *)(dst + 48), p3);
+    }
+    else {
+        // Drop every 4th byte. Stores overlap, the last one writes exactly 12 bytes.
+        __m128i const mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        _mm_storeu_si128((__m128i *)(dst +  0), _mm_shuffle_epi8(p0, mask));
+        _mm_storeu_si128((__m128i *)(dst + 12), _mm_shuffle_epi8(p1, mask));
+        _mm_storeu_si128((__m128i *)(dst + 24), _mm_shuffle_epi8(p2, mask));
+        __m128i q3 = _mm_shuffle_epi8(p3, mask);
+        _mm_storel_epi64((__m128i *)(dst + 36), q3);
+        int32_t tail = _mm_extract_epi32(q3, 2);
+        memcpy(dst + 44, &tail, 4);
+    }
+}
+
+// (x + 32) >> 6, for two halves of 8 pixels, packed into 16 bytes.
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i _pack16(__m128i lo, __m128i hi) {
+    __m128i const k32 = _mm_set1_epi16(32);
+    return _mm_packus_epi16(_mm_srai_epi16(_mm_adds_epi16(lo, k32), 6), _mm_srai_epi16(_mm_adds_epi16(hi, k32), 6));
+}
+
+template <bool kNV12, int kLayout>
+__attribute__((target("sse4.1")))
+static int _rowSSE41(uint8_t const * y, uint8_t const * u, uint8_t const * v, uint8_t * dst, int width, YuvToRgb::Coefs const & c) {
+    constexpr int bpp = (kLayout == kBGRA || kLayout == kRGBA) ? 4 : 3;
+    __m128i const y_off = _mm_set1_epi16(c.y_off);
+    __m128i const y_mul = _mm_set1_epi16(c.y_mul);
+    __m128i const rv    = _mm_set1_epi16(c.rv);
+    __m128i const gu    = _mm_set1_epi16(c.gu);
+    __m128i const gv    = _mm_set1_epi16(c.gv);
+    __m128i const bu    = _mm_set1_epi16(c.bu);
+    __m128i const k128  = _mm_set1_epi16(128);
+    __m128i const zero  = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // 8 chroma samples in 16-bit lanes.
+        __m128i uu, vv;
+        if (kNV12) {
+            __m128i uv = _mm_loadu_si128((__m128i const *)(u + x));
+            uu = _mm_and_si128(uv, _mm_set1_epi16(0xff));
+            vv = _mm_srli_epi16(uv, 8);
+        }
+        else {
+            uu = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *)(u + x / 2)));
+            vv = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *)(v + x / 2)));
+        }
+        uu = _mm_slli_epi16(_mm_sub_epi16(uu, k128), 8);
+        vv = _mm_slli_epi16(_mm_sub_epi16(vv, k128), 8);
+        __m128i r_uv = _mm_mulhrs_epi16(vv, rv);
+        __m128i g_uv = _mm_adds_epi16(_mm_mulhrs_epi16(uu, gu), _mm_mulhrs_epi16(vv, gv));
+        __m128i b_uv = _mm_mulhrs_epi16(uu, bu);
+
+        __m128i yy = _mm_loadu_si128((__m128i const *)(y + x));
+        __m128i y_lo = _mm_unpacklo_epi8(yy, zero);
+        __m128i y_hi = _mm_unpackhi_epi8(yy, zero);
+        y_lo = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(y_lo, y_off), 7), y_mul);
+        y_hi = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(y_hi, y_off), 7), y_mul);
+
+        // Each chroma sample covers 2 pixels.
+        __m128i r = _pack16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(r_uv, r_uv)), _mm_adds_epi16(y_hi, _mm_unpackhi_epi16(r_uv, r_uv)));
+        __m128i g = _pack16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(g_uv, g_uv)), _mm_adds_epi16(y_hi, _mm_unpackhi_epi16(g_uv, g_uv)));
+        __m128i b = _pack16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(b_uv, b_uv)), _mm_adds_epi16(y_hi, _mm_unpackhi_epi16(b_uv, b_uv)));
+        _store16<kLayout>(dst + x * bpp, r, g, b);
+    }
+    return x;
+}
+
+// Duplicate 16 chroma terms for 32 pixels, as two vectors in pixel order.
+__attribute__((target("avx2"), always_inline))
+static inline void _dup32(__m256i t, __m256i & px0, __m256i & px1) {
+    __m256i lo = _mm256_unpacklo_epi16(t, t);  // c0..c3 | c8..c11
+    __m256i hi = _mm256_unpackhi_epi16(t, t);  // c4..c7 | c12..c15
+    px0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+    px1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i _pack32(__m256i px0, __m256i px1) {
+    __m256i const k32 = _mm256_set1_epi16(32);
+    __m256i ret = _mm256_packus_epi16(
+        _mm256_srai_epi16(_mm256_adds_epi16(px0, k32), 6),
+        _mm256_srai_epi16(_mm256_adds_epi16(px1, k32), 6)
+    );
+    return _mm256_permute4x64_epi64(ret, 0xD8);  // packing works in 128-bit lanes
+}
+
+template <bool kNV12, int kLayout>
+__attribute__((target("avx2")))
+static int _rowAVX2(uint8_t const * y, uint8_t const * u, uint8_t const * v, uint8_t * dst, int width, YuvToRgb::Coefs const & c) {
+    constexpr int bpp = (kLayout == kBGRA || kLayout == kRGBA) ? 4 : 3;
+    __m256i const y_off = _mm256_set1_epi16(c.y_off);
+    __m256i const y_mul = _mm256_set1_epi16(c.y_mul);
+    __m256i const rv    = _mm256_set1_epi16(c.rv);
+    __m256i const gu    = _mm256_set1_epi16(c.gu);
+    __m256i const gv    = _mm256_set1_epi16(c.gv);
+    __m256i const bu    = _mm256_set1_epi16(c.bu);
+    __m256i const k128  = _mm256_set1_epi16(128);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        // 16 chroma samples in 16-bit lanes.
+        __m256i uu, vv;
+        if (kNV12) {
+            __m256i uv = _mm256_loadu_si256((__m256i const *)(u + x));
+            uu = _mm256_and_si256(uv, _mm256_set1_epi16(0xff));
+            vv = _mm256_srli_epi16(uv, 8);
+        }
+        else {
+            uu = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(u + x / 2)));
+            vv = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(v + x / 2)));
+        }
+        uu = _mm256_slli_epi16(_mm256_sub_epi16(uu, k128), 8);
+        vv = _mm256_slli_epi16(_mm256_sub_epi16(vv, k128), 8);
+        __m256i r_uv0, r_uv1, g_uv0, g_uv1, b_uv0, b_uv1;
+        _dup32(_mm256_mulhrs_epi16(vv, rv), r_uv0, r_uv1);
+        _dup32(_mm256_adds_epi16(_mm256_mulhrs_epi16(uu, gu), _mm256_mulhrs_epi16(vv, gv)), g_uv0, g_uv1);
+        _dup32(_mm256_mulhrs_epi16(uu, bu), b_uv0, b_uv1);
+
+        __m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(y + x)));
+        __m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(y + x + 16)));
+        y0 = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y0, y_off), 7), y_mul);
+        y1 = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y1, y_off), 7), y_mul);
+
+        __m256i r = _pack32(_mm256_adds_epi16(y0, r_uv0), _mm256_adds_epi16(y1, r_uv1));
+        __m256i g = _pack32(_mm256_adds_epi16(y0, g_uv0), _mm256_adds_epi16(y1, g_uv1));
+        __m256i b = _pack32(_mm256_adds_epi16(y0, b_uv0), _mm256_adds_epi16(y1, b_uv1));
+        _store16<kLayout>(dst + x * bpp, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+        _store16<kLayout>(dst + (x + 16) * bpp, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1));
+    }
+    return x;
+}
+
+#endif
+
+// * -------------------------------------------------------------------------------------------------------------- * //
+// *                                                    Dispatch                                                    * //
+// * -------------------------------------------------------------------------------------------------------------- * //
+
+enum Isa { kIsaC, kIsaSSE41, kIsaAVX2 };
+
+static Isa _DetectIsa() {
+#ifdef VIO_YUV2RGB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))   return kIsaAVX2;
+    if (__builtin_cpu_supports("sse4.1")) return kIsaSSE41;
+#endif
+    return kIsaC;
+}
+
+static Isa _GetIsa() {
+    static const Isa isa = _DetectIsa();
+    return isa;
+}
+
+const char * YuvToRgb::Isa() {
+    switch (_GetIsa()) {
+    case kIsaAVX2:  return "avx2";
+    case kIsaSSE41: return "sse4.1";
+    default:        return "c";
+    }
+}
+
+template <bool kNV12, int kLayout>
+static void _SelectRows(YuvToRgb::RowFn & row_c, YuvToRgb::RowFn & row_simd) {
+    row_c = &_rowC<kNV12, kLayout>;
+    row_simd = nullptr;
+#ifdef VIO_YUV2RGB_X86
+    switch (_GetIsa()) {
+    case kIsaAVX2:  row_simd = &_rowAVX2 <kNV12, kLayout>; break;
+    case kIsaSSE41: row_simd = &_rowSSE41<kNV12, kLayout>; break;
+    default: break;
+    }
+#endif
+}
+
+template <bool kNV12>
+static bool _SelectRows(AVPixelFormat dst_fmt, YuvToRgb::RowFn & row_c, YuvToRgb::RowFn & row_simd) {
+    switch (dst_fmt) {
+    case AV_PIX_FMT_BGR24: _SelectRows<kNV12, kBGR >(row_c, row_simd); return true;
+    case AV_PIX_FMT_RGB24: _SelectRows<kNV12, kRGB >(row_c, row_simd); return true;
+    case AV_PIX_FMT_BGRA:  _SelectRows<kNV12, kBGRA>(row_c, row_simd); return true;
+    case AV_PIX_FMT_RGBA:  _SelectRows<kNV12, kRGBA>(row_c, row_simd); return true;
+    default: return false;
+    }
+}
+
+bool YuvToRgb::init(AVPixelFormat src_fmt, AVPixelFormat dst_fmt, AVColorSpace colorspace, AVColorRange range) {
+    row_c_ = row_simd_ = nullptr;
+
+    // Matrix, unspecified ones are taken as BT.601 like swscale.
+    double kr = 0, kb = 0;
+    switch (colorspace) {
+    case AVCOL_SPC_BT709:
+        kr = 0.2126; kb = 0.0722; break;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+    case AVCOL_SPC_UNSPECIFIED:
+        kr = 0.299;  kb = 0.114;  break;
+    default:
+        return false;
+    }
+
+    bool ok = false;
+    switch (src_fmt) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P: ok = _SelectRows<false>(dst_fmt, row_c_, row_simd_); break;
+    case AV_PIX_FMT_NV12:     ok = _SelectRows<true >(dst_fmt, row_c_, row_simd_); break;
+    default: break;
+    }
+    if (!ok) {
+        row_c_ = row_simd_ = nullptr;
+        return false;
+    }
+
+    bool full = (range == AVCOL_RANGE_JPEG) || (src_fmt == AV_PIX_FMT_YUVJ420P);
+    double ys = (full) ? 1.0 : 255.0 / 219.0;
+    double cs = (full) ? 1.0 : 255.0 / 224.0;
+    double kg = 1.0 - kr - kb;
+    coefs_.y_off = (full) ? 0 : 16;
+    coefs_.y_mul = (int16_t)std::lround(ys * (1 << 14));
+    coefs_.rv    = (int16_t)std::lround( 2.0 * (1.0 - kr) * cs * (1 << 13));
+    coefs_.gu    = (int16_t)std::lround(-2.0 * (1.0 - kb) * kb / kg * cs * (1 << 13));
+    coefs_.gv    = (int16_t)std::lround(-2.0 * (1.0 - kr) * kr / kg * cs * (1 << 13));
+    coefs_.bu    = (int16_t)std::lround( 2.0 * (1.0 - kb) * cs * (1 << 13));
+
+    src_fmt_   = src_fmt;
+    dst_fmt_   = dst_fmt;
+    dst_bytes_ = (dst_fmt == AV_PIX_FMT_BGRA || dst_fmt == AV_PIX_FMT_RGBA) ? 4 : 3;
+    return true;
+}
+
+void YuvToRgb::convert(
+    uint8_t const * const src[], int const src_stride[],
+    uint8_t * dst, int dst_stride,
+    int width, int y0, int h
+) const {
+    bool const nv12 = (src_fmt_ == AV_PIX_FMT_NV12);
+    for (int y = y0; y < y0 + h; ++y) {
+        uint8_t const * yrow = src[0] + (ptrdiff_t)y * src_stride[0];
+        uint8_t const * urow = src[1] + (ptrdiff_t)(y >> 1) * src_stride[1];
+        uint8_t const * vrow = (nv12) ? urow + 1 : src[2] + (ptrdiff_t)(y >> 1) * src_stride[2];
+        uint8_t * drow = dst + (ptrdiff_t)y * dst_stride;
+
+        int x = (row_simd_) ? row_simd_(yrow, urow, vrow, drow, width, coefs_) : 0;
+        if (x < width) {
+            // The rest pixels, chroma of odd x is the same as its left one.
+            int cx = (nv12) ? x : x / 2;
+            row_c_(yrow + x, urow + cx, vrow + cx, drow + x * dst_bytes_, width - x, coefs_);
+        }
+    }
+}
+
+}
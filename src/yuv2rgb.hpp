@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+namespace vio {
+
+/**
+ * Colour conversion of 8-bit yuv420p (yuvj420p) and nv12 into bgr24, rgb24, bgra and rgba, at the same size.
+ * - BT.601 or BT.709 matrix, limited or full range. Chroma of each 2x2 block is shared, as swscale does unscaled.
+ * - Rows are converted with SSE4.1 or AVX2 kernels, selected at runtime by the cpu, or in plain C.
+ *   All kernels give the same result, with 16-bit fixed-point arithmetic.
+ * */
+class YuvToRgb {
+public:
+    // Fixed-point coefficients.
+    struct Coefs {
+        int16_t y_off;  // 16 for limited range, 0 for full range
+        int16_t y_mul;  // Q14
+        int16_t rv, gu, gv, bu;  // Q13
+    };
+    using RowFn = int (*)(uint8_t const * y, uint8_t const * u, uint8_t const * v, uint8_t * dst, int width, Coefs const & c);
+
+    YuvToRgb() : src_fmt_(AV_PIX_FMT_NONE), dst_fmt_(AV_PIX_FMT_NONE), coefs_(), row_simd_(nullptr), row_c_(nullptr), dst_bytes_(0) {}
+
+    // False if the conversion is not supported, e.g. other formats or matrices.
+    bool init(AVPixelFormat src_fmt, AVPixelFormat dst_fmt, AVColorSpace colorspace, AVColorRange range);
+    bool valid() const { return row_c_ != nullptr; }
+
+    // Convert rows [y0, y0 + h) of the image.
+    void convert(uint8_t const * const src[], int const src_stride[], uint8_t * dst, int dst_stride, int width, int y0, int h) const;
+
+    // The instruction set of kernels: "avx2", "sse4.1" or "c".
+    static auto Isa() -> const char *;
+
+private:
+    AVPixelFormat src_fmt_;
+    AVPixelFormat dst_fmt_;
+    Coefs coefs_;
+    RowFn row_simd_;  // nullptr without simd
+    RowFn row_c_;
+    int dst_bytes_;   // bytes per pixel
+};
+
+}
@@ -1,5 +1,8 @@
-from .reader import VideoReader, BytesVideoReader
+from .reader import VideoReader, BytesVideoReader, StreamVideoReader, set_frame_cache_limit, frame_memory_usage, LOWRES_AUTO
 from .writer import VideoWriter
 from .props import get_video_properties
 
-__all__ = ["VideoReader", "BytesVideoReader", "VideoWriter", "get_video_properties"]
+__all__ = [
+    "VideoReader", "BytesVideoReader", "StreamVideoReader", "VideoWriter", "get_video_properties",
+    "set_frame_cache_limit", "frame_memory_usage", "LOWRES_AUTO",
+]
@@ -1,24 +1,161 @@
-from typing import Optional, Tuple
+from typing import Any, Iterable, List, Optional, Sequence, Tuple, Union
 import numpy as np
 import numpy.typing as npt
 
 from .bind.videoio import VideoReader as CPP_VideoReader
+from .bind import videoio as _cpp
+
+
+LOWRES_AUTO = _cpp.LOWRES_AUTO
+DEFAULT_READAHEAD = 8 << 20
+
+
+def set_frame_cache_limit(n_bytes: int):
+    """Budget of frame caches of all readers in this process, 0 for no limit.
+    Caches shrink (or skip caching) so that pooled buffers plus cached frames stay in it.
+    It's not a cap of memory: converted frames always get buffers, and frames owned by decoders are not counted.
+    """
+    _cpp.set_frame_cache_limit(n_bytes)
+
+
+def frame_memory_usage() -> int:
+    """Bytes of frame memory used by all readers in this process: pooled buffers and cached frames."""
+    return _cpp.frame_memory_usage()
 
 
 class _VideoReader():
     def __init__(self):
         self._reader = CPP_VideoReader()
 
-    def open(self, filename: str, pix_fmt: str = "bgr"):
+    def __del__(self):
+        # Workers (prefetch, stream read-ahead) may call python, they are stopped without holding the gil.
+        reader = getattr(self, "_reader", None)
+        if reader is not None:
+            reader.release()
+
+    def open(
+        self,
+        filename: str,
+        pix_fmt: str = "bgr",
+        prefetch: int = 0,
+        index: bool = False,
+        index_cache: Optional[str] = None,
+        layout: str = "hwc",
+        dtype: str = "uint8",
+        mean: Optional[Sequence[float]] = None,
+        std: Optional[Sequence[float]] = None,
+        image_size: Tuple[int, int] = (0, 0),
+        keyframes_only: bool = False,
+        lowres: int = 0,
+        roi: Optional[Tuple[int, int, int, int]] = None,
+        io_mode: str = "mmap",
+        readahead: int = DEFAULT_READAHEAD,
+    ):
+        """pix_fmt: "bgr", "rgb", "bgra", "rgba" or "gray". Gray is the luma plane of yuv videos, at native size
+        it's exported without conversion (zero-copy with read(zero_copy=True), values are kept in the video's range).
+        Or planar "yuv420p", "yuv422p", "yuv444p", "nv12", or "yuv" for the decoded 8-bit planar yuv (yuv420p for
+        others), see read_planes. The decoded planes are exported without conversion when the format is kept.
+        index_cache: a directory or a sidecar file to cache the index (only used when index is True).
+        layout, dtype, mean and std: the output of frames, see set_output.
+        image_size: (width, height) of output images, (0, 0) for the video size.
+        keyframes_only: only decode key frames, read() returns the next one (pos_msec is its timestamp).
+        lowres: decode at 1/2^lowres of the size if the codec supports, LOWRES_AUTO to choose by image_size.
+        Images of keyframes_only or lowres are scaled by fast bilinear, for thumbnails.
+        roi: (x, y, w, h) region of frames to convert only, see set_roi.
+        io_mode: how the file is read.
+            "mmap": from a memory mapping, hinted random by seeking and sequential by runs of reads.
+            "stdio": fread.
+            "pread": readers of a file share one descriptor, e.g. many readers for parallel random access.
+            "readahead": a native thread reads a window ahead, e.g. for network filesystems (see io_stats).
+        readahead: bytes of the window of "readahead".
+        """
         self._reader.release()
-        self._reader.open(filename, pix_fmt=pix_fmt)
+        self._reader.io_mode = io_mode
+        self._reader.readahead = readahead
+        self._reader.prefetch = prefetch
+        self._reader.indexing = index
+        self._reader.index_cache = index_cache or ""
+        self._reader.keyframes_only = keyframes_only
+        self._reader.lowres = lowres
+        self.set_roi(roi)
+        self.set_output(layout, dtype, mean, std)
+        self._reader.open(filename, pix_fmt=pix_fmt, image_size=image_size)
 
-    def read(self) -> Tuple[bool, Optional[npt.NDArray[np.uint8]]]:
-        got, im = self._reader.read()
+    def set_output(
+        self,
+        layout: str = "hwc",
+        dtype: str = "uint8",
+        mean: Optional[Sequence[float]] = None,
+        std: Optional[Sequence[float]] = None,
+    ):
+        """Output frames as "hwc" or "chw" arrays of "uint8", "float32" or "float16".
+        Float values are in [0, 1], then (v - mean) / std per channel if mean and std are given.
+        Frames are converted and normalized in one pass, without intermediate arrays.
+        The channel count (of pix_fmt) is checked at open.
+        """
+        mean = [float(x) for x in mean] if mean is not None else []
+        std = [float(x) for x in std] if std is not None else []
+        if not self._reader.set_output(layout=layout, dtype=dtype, mean=mean, std=std):
+            raise ValueError("Invalid output: layout={}, dtype={}, mean={}, std={}".format(layout, dtype, mean, std))
+
+    def set_roi(self, roi: Optional[Tuple[int, int, int, int]]):
+        """Only convert the region (x, y, w, h) of frames, None for whole frames. It can be changed between reads.
+        The region is scaled to image_size given at open, or kept in size without it.
+        x and y are rounded down to the chroma subsampling (e.g. even numbers for yuv420p).
+        """
+        x, y, w, h = roi if roi is not None else (0, 0, 0, 0)
+        if not self._reader.set_roi((int(x), int(y), int(w), int(h))):
+            raise ValueError("Invalid roi: {}".format(roi))
+
+    @property
+    def roi(self) -> Tuple[int, int, int, int]:
+        return self._reader.roi
+
+    def read(self, zero_copy: bool = False) -> Tuple[bool, Optional[npt.NDArray]]:
+        """Read next frame.
+        If zero_copy is True, the returned array shares the decoder's frame buffer without copying.
+        Its rows may be padded, so it is not always c-contiguous. Only for the default (hwc, uint8) output.
+        """
+        got, im = self._reader.read(zero_copy=zero_copy)
         if not got:
             return False, None
         return got, im
 
+    def read_planes(self, zero_copy: bool = False) -> Tuple[bool, List[npt.NDArray[np.uint8]]]:
+        """Read next frame of planar yuv as planes, e.g. [Y, U, V] of (H, W), (H/2, W/2), (H/2, W/2) for yuv420p,
+        or [Y, UV] of (H, W), (H/2, W/2, 2) for nv12. With zero_copy, planes share the frame buffers (rows padded).
+        read(), read_batch() and get_frames() give the planes packed one after another in bytes, as self.planes.
+        """
+        return self._reader.read_planes(zero_copy=zero_copy)
+
+    @property
+    def planes(self) -> List[Tuple[int, Tuple[int, ...]]]:
+        """(offset, shape) of planes in the packed bytes of a planar yuv frame, empty for packed images."""
+        return [(off, (h, w) if c == 1 else (h, w, c)) for off, h, w, c in self._reader.planes]
+
+    def read_into(self, out: npt.NDArray) -> bool:
+        """Read next frame into a preallocated array, converted straight into it without allocation.
+        out is writable, of shape (H, W, C) or (C, H, W) and dtype of the output. Images may have padded rows,
+        other outputs are c-contiguous. Returns False at the end of video or if out is invalid.
+        """
+        return self._reader.read_into(out)
+
+    def seek_and_read_into(self, ifrm: int, out: npt.NDArray) -> bool:
+        """Seek to frame ifrm and read it into out, as read_into."""
+        return self._reader.seek_and_read_into(ifrm, out)
+
+    def read_batch(self, n: int) -> npt.NDArray:
+        """Read at most n frames into one (N, H, W, C) array, or (N, C, H, W) for chw output.
+        N is less than n at the end of video.
+        """
+        return self._reader.read_batch(n)
+
+    def get_frames(self, indices: Sequence[int]) -> Tuple[bool, npt.NDArray]:
+        """Get frames of indices as one (N, H, W, C) array (or (N, C, H, W) for chw output), in the given order.
+        Each GOP is decoded once. It's much faster than seeking for each frame.
+        """
+        return self._reader.get_frames([int(x) for x in indices])
+
     def release(self):
         self._reader.release()
     
@@ -28,6 +165,88 @@ class _VideoReader():
     def seek_msec(self, ts: float) -> bool:
         return self._reader.seek_msec(ts)
 
+    @property
+    def indexed(self) -> bool:
+        return self._reader.indexed
+
+    @property
+    def cache_bytes(self) -> int:
+        """Byte budget of the decoded frame cache (LRU), 0 disables caching.
+        By default it's about 20 decoded frames of the video (at least 64 MB), e.g. about 240 MB for 4K yuv420p.
+        """
+        return self._reader.cache_bytes
+
+    @cache_bytes.setter
+    def cache_bytes(self, n: int):
+        self._reader.cache_bytes = n
+
+    @property
+    def cache_stats(self) -> Tuple[int, int]:
+        """(hits, misses) of the decoded frame cache."""
+        return self._reader.cache_hits, self._reader.cache_misses
+
+    @property
+    def io_stats(self) -> dict:
+        """Counters of the input: "bytes_read" from the source, and "stall_ms" the demuxer waited for bytes.
+        Zeros for inputs that don't count (mmap, stdio and bytes).
+        """
+        return self._reader.io_stats
+
+    @property
+    def prefetch(self) -> int:
+        return self._reader.prefetch
+
+    @prefetch.setter
+    def prefetch(self, n: int):
+        self._reader.prefetch = n
+
+    @property
+    def stride(self) -> int:
+        """read() steps this many frames. Only kept frames are converted, non-reference frames are not decoded
+        (so a kept frame is the first decodable one at or after its index), and seeking skips over GOPs.
+        """
+        return self._reader.stride
+
+    @stride.setter
+    def stride(self, n: int):
+        self._reader.stride = n
+
+    @property
+    def sample_fps(self) -> float:
+        """Sample at about this fps (stride is round(fps / sample_fps)), 0 to use stride."""
+        return self._reader.sample_fps
+
+    @sample_fps.setter
+    def sample_fps(self, fps: float):
+        self._reader.sample_fps = fps
+
+    @property
+    def fast_convert(self) -> bool:
+        """Convert yuv420p / nv12 into rgb with simd kernels instead of swscale (at native size). Used at next open."""
+        return self._reader.fast_convert
+
+    @fast_convert.setter
+    def fast_convert(self, enable: bool):
+        self._reader.fast_convert = enable
+
+    @property
+    def convert_threads(self) -> int:
+        """Number of threads converting the pixel format, each converts a horizontal slice.
+        Only for output of the decoded size, scaled output (image_size) is converted in one thread.
+        """
+        return self._reader.convert_threads
+
+    @convert_threads.setter
+    def convert_threads(self, n: int):
+        self._reader.convert_threads = n
+
+    @property
+    def peak_memory(self) -> int:
+        """Peak bytes of frames held by the reader (cached, converted and prefetched ones) since opening.
+        Frames owned by the decoder (e.g. its reference frames) are not counted.
+        """
+        return self._reader.peak_memory
+
     @property
     def fps(self) -> float:
         return self._reader.fps
@@ -75,13 +294,112 @@ class _VideoReader():
 
 
 class VideoReader(_VideoReader):
-    def __init__(self, filename: str = "", pix_fmt: str = "bgr"):
+    def __init__(
+        self,
+        filename: str = "",
+        pix_fmt: str = "bgr",
+        prefetch: int = 0,
+        index: bool = False,
+        index_cache: Optional[str] = None,
+        layout: str = "hwc",
+        dtype: str = "uint8",
+        mean: Optional[Sequence[float]] = None,
+        std: Optional[Sequence[float]] = None,
+        image_size: Tuple[int, int] = (0, 0),
+        keyframes_only: bool = False,
+        lowres: int = 0,
+        roi: Optional[Tuple[int, int, int, int]] = None,
+        io_mode: str = "mmap",
+        readahead: int = DEFAULT_READAHEAD,
+    ):
         super().__init__()
         if len(filename) > 0:
-            self._reader.open(filename, pix_fmt=pix_fmt)
+            self.open(
+                filename, pix_fmt=pix_fmt, prefetch=prefetch, index=index, index_cache=index_cache,
+                layout=layout, dtype=dtype, mean=mean, std=std,
+                image_size=image_size, keyframes_only=keyframes_only, lowres=lowres, roi=roi, io_mode=io_mode,
+                readahead=readahead,
+            )
 
 
 class BytesVideoReader(_VideoReader):
-    def __init__(self, bytes: npt.NDArray[np.uint8], pix_fmt: str = "bgr"):
+    def __init__(
+        self,
+        bytes: Union[bytes, bytearray, memoryview, npt.NDArray[np.uint8]],
+        pix_fmt: str = "bgr",
+        prefetch: int = 0,
+        index: bool = False,
+        layout: str = "hwc",
+        dtype: str = "uint8",
+        mean: Optional[Sequence[float]] = None,
+        std: Optional[Sequence[float]] = None,
+        image_size: Tuple[int, int] = (0, 0),
+        keyframes_only: bool = False,
+        lowres: int = 0,
+        roi: Optional[Tuple[int, int, int, int]] = None,
+    ):
+        """bytes: any contiguous buffer of the video, read in place without copying.
+        The reader keeps a reference to it until released, so it needn't be kept alive by the caller.
+        """
         super().__init__()
-        self._reader.open_bytes(bytes, pix_fmt=pix_fmt)
+        self._reader.prefetch = prefetch
+        self._reader.indexing = index
+        self._reader.keyframes_only = keyframes_only
+        self._reader.lowres = lowres
+        self.set_roi(roi)
+        self.set_output(layout, dtype, mean, std)
+        self._reader.open_bytes(bytes, pix_fmt=pix_fmt, image_size=image_size)
+
+
+class _ChunkReader():
+    """Reads an iterator of byte chunks like a file, slicing chunks without joining them."""
+
+    def __init__(self, chunks: Iterable[Any]):
+        self._chunks = iter(chunks)
+        self._view = memoryview(b"")
+
+    def read(self, n: int) -> memoryview:
+        while len(self._view) == 0:
+            chunk = next(self._chunks, None)
+            if chunk is None:
+                return self._view
+            self._view = memoryview(chunk).cast("B")
+        ret, self._view = self._view[:n], self._view[n:]
+        return ret
+
+
+class StreamVideoReader(_VideoReader):
+    def __init__(
+        self,
+        source: Union[Any, Iterable[Any]],
+        pix_fmt: str = "bgr",
+        prefetch: int = 0,
+        readahead: int = DEFAULT_READAHEAD,
+        layout: str = "hwc",
+        dtype: str = "uint8",
+        mean: Optional[Sequence[float]] = None,
+        std: Optional[Sequence[float]] = None,
+        image_size: Tuple[int, int] = (0, 0),
+        keyframes_only: bool = False,
+        lowres: int = 0,
+        roi: Optional[Tuple[int, int, int, int]] = None,
+    ):
+        """source: a binary file-like object (read(n), and seek() if seekable() is True), or an iterable of
+        byte chunks (e.g. a download in progress). Decoding starts with the first bytes.
+        Non-seekable sources are read sequentially: they are not indexed and seeking fails.
+        readahead: bytes read ahead of the decoder by a native thread, 0 reads when the decoder needs.
+        """
+        super().__init__()
+        if hasattr(source, "read"):
+            read = source.read
+            seekable = getattr(source, "seekable", None)
+            seek = source.seek if seekable is not None and seekable() else None
+        else:
+            read = _ChunkReader(source).read
+            seek = None
+        self._reader.prefetch = prefetch
+        self._reader.keyframes_only = keyframes_only
+        self._reader.lowres = lowres
+        self.set_roi(roi)
+        self.set_output(layout, dtype, mean, std)
+        self._reader.open_stream(read, seek, pix_fmt=pix_fmt, image_size=image_size, readahead=readahead)